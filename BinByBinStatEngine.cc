@@ -0,0 +1,78 @@
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "BinByBinStatEngine.h"
+
+
+
+
+
+BinByBinStatEngine::BinByBinStatEngine(const std::vector<double>& dataError,
+                                       const std::vector<double>& signalContent,
+                                       const std::vector<double>& backgroundContent,
+                                       const std::vector<double>& backgroundError):
+dataError_(dataError),
+signalContent_(signalContent),
+backgroundContent_(backgroundContent),
+backgroundError_(backgroundError)
+{
+  const size_t nBins = dataError_.size();
+  if(signalContent_.size() != nBins || backgroundContent_.size() != nBins || backgroundError_.size() != nBins){
+    std::cerr << "Error in BinByBinStatEngine! Inconsistent number of bins of data, signal and background\n...break\n" << std::endl;
+    exit(1);
+  }
+}
+
+
+
+void BinByBinStatEngine::evaluate(const std::vector<double>& sampleContent, const std::vector<double>& sampleError, const bool prune)
+{
+  const size_t nBins = this->nBins();
+  if(sampleContent.size() != nBins || sampleError.size() != nBins){
+    std::cerr << "Error in BinByBinStatEngine::evaluate()! Inconsistent number of bins of sample\n...break\n" << std::endl;
+    exit(1);
+  }
+
+  keep_.assign(nBins, 1);
+  shiftedUp_.resize(nBins);
+  shiftedDown_.resize(nBins);
+
+  const double* dataError = dataError_.data();
+  const double* signalContent = signalContent_.data();
+  const double* backgroundContent = backgroundContent_.data();
+  const double* backgroundError = backgroundError_.data();
+  const double* content = sampleContent.data();
+  const double* error = sampleError.data();
+  char* keep = keep_.data();
+  float* up = shiftedUp_.data();
+  float* down = shiftedDown_.data();
+
+  for(size_t iBin = 0; iBin < nBins; ++iBin){
+
+    // Shifted contents, protected against shifts to zero or below
+    const float binError = error[iBin];
+    const float binContent = content[iBin];
+    up[iBin] = std::max(binContent + binError, float(1e-8));
+    down[iBin] = std::max(binContent - binError, float(1e-8));
+
+    // MC stat. prunining method
+    /* NOTE: Information obtained from the following resources
+       https://twiki.cern.ch/twiki/bin/view/CMS/TTbarHbbRun2ReferenceAnalysisLimits
+       https://indico.cern.ch/event/373752/session/6/contribution/15/attachments/744533/1021297/Hbb_bbbStat_24022015.pdf
+       https://github.com/cms-ttH/ttH-Limits/blob/13TeV/python/datacard_ttbb13TeV.py
+     */
+    const double otherFrac = std::sqrt(backgroundError[iBin]*backgroundError[iBin] - error[iBin]*error[iBin]);
+    const bool pruned = backgroundError[iBin] < dataError[iBin]/5.
+                        || signalContent[iBin]/backgroundContent[iBin] < 0.01
+                        || content[iBin] < 0.01
+                        || otherFrac/backgroundError[iBin] > 0.95;
+    keep[iBin] = !(prune && pruned);
+  }
+
+  survivingBins_.clear();
+  for(size_t iBin = 0; iBin < nBins; ++iBin){
+    if(keep[iBin]) survivingBins_.push_back(iBin);
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef BinByBinStatEngine_h
+#define BinByBinStatEngine_h
+
+#include <vector>
+#include <cstddef>
+
+
+
+
+
+/// Engine for the MC bin-by-bin statistical shape uncertainties of one event category
+/// Bin contents and errors are held in contiguous arrays, the pruning mask and the shifted
+/// contents of a sample are evaluated for all bins in a single pass
+class BinByBinStatEngine{
+
+ public:
+
+  /// Constructor, from the bin errors of data and the bin contents/errors of the signal and background sums
+  BinByBinStatEngine(const std::vector<double>& dataError,
+                     const std::vector<double>& signalContent,
+                     const std::vector<double>& backgroundContent,
+                     const std::vector<double>& backgroundError);
+
+  /// Destructor
+  ~BinByBinStatEngine(){}
+
+  /// Evaluate pruning mask and up/down shifted contents for all bins of the sample
+  void evaluate(const std::vector<double>& sampleContent, const std::vector<double>& sampleError, const bool prune);
+
+  /// Number of bins
+  size_t nBins()const{return dataError_.size();}
+
+  /// Indices (starting at 0) of the bins whose nuisance survives the pruning, in ascending order
+  const std::vector<size_t>& survivingBins()const{return survivingBins_;}
+
+  /// Bin content shifted up or down by its statistical error, for all bins of the evaluated sample
+  const std::vector<float>& shiftedContent(const int shift)const{return shift < 0 ? shiftedDown_ : shiftedUp_;}
+
+ private:
+
+  /// Bin errors of data
+  const std::vector<double> dataError_;
+
+  /// Bin contents of the signal sum
+  const std::vector<double> signalContent_;
+
+  /// Bin contents of the background sum
+  const std::vector<double> backgroundContent_;
+
+  /// Bin errors of the background sum
+  const std::vector<double> backgroundError_;
+
+  /// Pruning mask of the evaluated sample, 1 for bins to be kept
+  std::vector<char> keep_;
+
+  /// Shifted contents of the evaluated sample
+  std::vector<float> shiftedUp_;
+  std::vector<float> shiftedDown_;
+
+  /// Bins surviving the pruning for the evaluated sample
+  std::vector<size_t> survivingBins_;
+};
+
+
+
+
+
+#endif
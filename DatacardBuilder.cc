@@ -0,0 +1,100 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <algorithm>
+
+#include "DatacardBuilder.h"
+#include "DatacardProfiler.h"
+
+
+
+
+
+DatacardBuilder::DatacardBuilder():
+sections_(numberOfSections),
+current_(header)
+{}
+
+
+
+DatacardBuilder& DatacardBuilder::section(const Section section)
+{
+  current_ = section;
+  return *this;
+}
+
+
+
+DatacardBuilder& DatacardBuilder::operator<<(const char* text)
+{
+  sections_[current_].append(text);
+  return *this;
+}
+
+
+
+DatacardBuilder& DatacardBuilder::operator<<(const std::string& text)
+{
+  sections_[current_].append(text);
+  return *this;
+}
+
+
+
+DatacardBuilder& DatacardBuilder::operator<<(std::ostream& (*)(std::ostream&))
+{
+  sections_[current_].push_back('\n');
+  return *this;
+}
+
+
+
+DatacardBuilder& DatacardBuilder::column(const std::string& text, const size_t width, const size_t maxLength)
+{
+  std::string& section = sections_[current_];
+
+  const size_t length = std::min(text.size(), maxLength);
+  section.append(text, 0, length);
+  if(length < width) section.append(width - length, ' ');
+
+  return *this;
+}
+
+
+
+DatacardBuilder& DatacardBuilder::column(const int number, const size_t width)
+{
+  return this->column(std::to_string(number), width);
+}
+
+
+
+bool DatacardBuilder::write(const std::string& fileName)const
+{
+  std::string text;
+
+  size_t size(0);
+  for(const std::string& section : sections_) size += section.size();
+  text.reserve(size);
+  for(const std::string& section : sections_) text.append(section);
+
+  std::ofstream file(fileName.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+  if(!file){
+    std::cerr << "Error in DatacardBuilder::write()! Cannot open datacard file: " << fileName << std::endl;
+    return false;
+  }
+  file.write(text.data(), text.size());
+
+  DatacardProfiler::count(DatacardProfiler::fileOpens);
+  DatacardProfiler::count(DatacardProfiler::datacardLines, std::count(text.begin(), text.end(), '\n'));
+
+  return file.good();
+}
+
+
+
+void DatacardBuilder::clear()
+{
+  for(std::string& section : sections_) section.clear();
+  current_ = header;
+}
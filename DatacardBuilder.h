@@ -0,0 +1,62 @@
+#ifndef DatacardBuilder_h
+#define DatacardBuilder_h
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+
+
+
+
+/// Builder of the text of one datacard
+/// The sections are accumulated in memory in any order, and written to file in one go
+class DatacardBuilder{
+
+ public:
+
+  /// Sections of the datacard, in the order they are written
+  enum Section{header, observation, rates, systematics, statistics, groups, numberOfSections};
+
+  /// Constructor
+  DatacardBuilder();
+
+  /// Destructor
+  ~DatacardBuilder(){}
+
+  /// Select the section the following text is appended to
+  DatacardBuilder& section(const Section section);
+
+  /// Append text to the current section
+  DatacardBuilder& operator<<(const char* text);
+  DatacardBuilder& operator<<(const std::string& text);
+
+  /// Append a line break to the current section (no flushing, for drop-in use of std::endl)
+  DatacardBuilder& operator<<(std::ostream& (*manipulator)(std::ostream&));
+
+  /// Append text left-aligned in a column of given width, truncated to at most maxLength characters
+  DatacardBuilder& column(const std::string& text, const size_t width, const size_t maxLength =std::string::npos);
+
+  /// Append integer left-aligned in a column of given width
+  DatacardBuilder& column(const int number, const size_t width);
+
+  /// Write all sections to the file, replacing its content
+  bool write(const std::string& fileName)const;
+
+  /// Remove all text
+  void clear();
+
+ private:
+
+  /// Text of each section
+  std::vector<std::string> sections_;
+
+  /// Section the text is currently appended to
+  Section current_;
+};
+
+
+
+
+
+#endif
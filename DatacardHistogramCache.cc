@@ -0,0 +1,166 @@
+#include <iostream>
+#include <cstdlib>
+
+#include <TFile.h>
+#include <TObject.h>
+#include <TH1.h>
+#include <TH1D.h>
+#include <TArrayD.h>
+
+#include "DatacardHistogramCache.h"
+#include "DatacardProfiler.h"
+
+
+
+
+
+DatacardHistogramCache::DatacardHistogramCache():
+snapshot_(0)
+{}
+
+
+
+const TH1* DatacardHistogramCache::get(const TString& fileName, const TString& histoName, const Systematic::Systematic& systematic)
+{
+  const Key key(fileName.Data(), histoName.Data(), systematic.name().Data());
+
+  Entry* entry(0);
+  InputFile* inputFile(0);
+  const HistogramSnapshot* snapshot(0);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    std::unique_ptr<Entry>& cached = histograms_[key];
+    if(!cached) cached.reset(new Entry());
+    entry = cached.get();
+
+    std::unique_ptr<InputFile>& file = inputFiles_[std::get<0>(key)];
+    if(!file) file.reset(new InputFile());
+    inputFile = file.get();
+
+    snapshot = snapshot_;
+  }
+
+  // Only the first request loads the histogram, concurrent requests of the same one wait for it
+  std::call_once(entry->loaded, [&]{entry->histogram.reset(this->load(fileName, histoName, systematic, snapshot, *inputFile));});
+
+  return entry->histogram.get();
+}
+
+
+
+TH1* DatacardHistogramCache::load(const TString& fileName, const TString& histoName, const Systematic::Systematic& systematic,
+                                  const HistogramSnapshot* snapshot, InputFile& inputFile)const
+{
+  TH1* histo(0);
+  HistogramSnapshot::View view;
+
+  // Take the histogram from the snapshot if available, else read it from file
+  // The snapshot arrays are copied here, as the TH1 is handed to ROOT for the output (array access goes through find())
+  if(snapshot && snapshot->find(fileName.Data(), histoName.Data(), systematic.name().Data(), view)){
+    histo = new TH1D(histoName, view.title.c_str(), view.numberOfBins, view.edges);
+    histo->SetContent(view.contents);
+    histo->Sumw2();
+    histo->GetSumw2()->Set(view.numberOfBins+2, view.sumw2);
+    histo->SetEntries(view.entries);
+
+    // Detach from any ROOT directory, the cache owns the histogram
+    histo->SetDirectory(0);
+  }
+  else{
+    std::lock_guard<std::mutex> lock(inputFile.mutex);
+
+    if(!inputFile.file){
+      inputFile.file.reset(TFile::Open(fileName, "READ"));
+      if(!inputFile.file || inputFile.file->IsZombie()){
+        std::cerr << "Error in DatacardHistogramCache! Cannot open input file: " << fileName << "\n...break\n" << std::endl;
+        exit(1);
+      }
+      DatacardProfiler::count(DatacardProfiler::fileOpens);
+    }
+
+    // Each histogram is read once, so the one read from file is taken over instead of cloned
+    TObject* object = inputFile.file->Get(histoName);
+    histo = dynamic_cast<TH1*>(object);
+    if(!histo){
+      // Not a histogram, nothing takes it over
+      delete object;
+    }
+    else{
+      // Detach from the file while holding its lock, this modifies the list of objects of the file
+      histo->SetDirectory(0);
+    }
+  }
+  DatacardProfiler::count(DatacardProfiler::histogramReads);
+
+  return histo;
+}
+
+
+
+bool DatacardHistogramCache::find(const TString& fileName, const TString& histoName, const Systematic::Systematic& systematic,
+                                  HistogramSnapshot::View& view)
+{
+  const HistogramSnapshot* snapshot(0);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    snapshot = snapshot_;
+  }
+
+  if(!snapshot || !snapshot->find(fileName.Data(), histoName.Data(), systematic.name().Data(), view)) return false;
+  DatacardProfiler::count(DatacardProfiler::histogramReads);
+
+  return true;
+}
+
+
+
+void DatacardHistogramCache::setSnapshot(const HistogramSnapshot* snapshot)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  snapshot_ = snapshot;
+}
+
+
+
+bool DatacardHistogramCache::exportSnapshot(const std::string& fileName)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::map<HistogramSnapshot::Key, HistogramSnapshot::Histogram> histograms;
+
+  for(const auto& cached : histograms_){
+    const TH1* histo = cached.second->histogram.get();
+    if(!histo) continue;
+
+    HistogramSnapshot::Histogram& histogram = histograms[cached.first];
+    histogram.title = histo->GetTitle();
+    histogram.entries = histo->GetEntries();
+
+    const int nBins = histo->GetNbinsX();
+    for(int iBin = 1; iBin <= nBins+1; ++iBin) histogram.edges.push_back(histo->GetXaxis()->GetBinLowEdge(iBin));
+    for(int iBin = 0; iBin <= nBins+1; ++iBin){
+      histogram.contents.push_back(histo->GetBinContent(iBin));
+      histogram.sumw2.push_back(histo->GetBinError(iBin)*histo->GetBinError(iBin));
+    }
+  }
+
+  return HistogramSnapshot::write(fileName, histograms);
+}
+
+
+
+void DatacardHistogramCache::clear()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  histograms_.clear();
+  inputFiles_.clear();
+}
+
+
+
+size_t DatacardHistogramCache::size()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return histograms_.size();
+}
@@ -0,0 +1,105 @@
+#ifndef DatacardHistogramCache_h
+#define DatacardHistogramCache_h
+
+#include <map>
+#include <tuple>
+#include <string>
+#include <memory>
+#include <mutex>
+
+#include <TString.h>
+#include <TH1.h>
+#include <TFile.h>
+
+#include "../../common/include/sampleHelpers.h"
+#include "HistogramSnapshot.h"
+
+
+
+
+
+/// Cache of input histograms of the datacard maker
+/// Each histogram is read from file exactly once per run, identified by (file, histogram name, systematic),
+/// and handed out as const view which stays valid for the lifetime of the cache
+/// If a histogram snapshot is set, histograms found in it are taken from there instead of being read from file:
+/// they can be accessed in place as arrays, and a TH1 copy of them is created only when requested as histogram
+/// Access is thread safe, the cache is locked only for the lookup: histograms of different files are read in parallel,
+/// those of the same file one after another, and threads requesting a histogram being read wait for it
+class DatacardHistogramCache{
+
+ public:
+
+  /// Constructor
+  DatacardHistogramCache();
+
+  /// Destructor
+  ~DatacardHistogramCache(){}
+
+  /// Access histogram, reading it from file at first access (returns NULL if the histogram does not exist)
+  const TH1* get(const TString& fileName, const TString& histoName, const Systematic::Systematic& systematic);
+
+  /// Access histogram in place in the snapshot, without creating a TH1 (returns false if it is not in the snapshot or none is set)
+  bool find(const TString& fileName, const TString& histoName, const Systematic::Systematic& systematic, HistogramSnapshot::View& view);
+
+  /// Set snapshot to take histograms from (not owned, NULL to read all histograms from file)
+  void setSnapshot(const HistogramSnapshot* snapshot);
+
+  /// Write all cached histograms to a snapshot file, returns false if writing failed (not while histograms are loaded)
+  bool exportSnapshot(const std::string& fileName);
+
+  /// Release all cached histograms and close the input files (not while histograms are loaded)
+  void clear();
+
+  /// Number of cached histograms
+  size_t size();
+
+ private:
+
+  DatacardHistogramCache(const DatacardHistogramCache&) = delete;
+  DatacardHistogramCache& operator=(const DatacardHistogramCache&) = delete;
+
+  /// Key of a cached histogram: file name, histogram name, systematic name
+  typedef std::tuple<std::string, std::string, std::string> Key;
+
+  /// Cached histogram, loaded once by the first thread requesting it
+  struct Entry{
+
+    /// Set once the histogram is loaded
+    std::once_flag loaded;
+
+    /// Histogram, NULL if it does not exist
+    std::unique_ptr<TH1> histogram;
+  };
+
+  /// Input root file, opened at its first access and kept open
+  struct InputFile{
+
+    /// Serializes the access to the file
+    std::mutex mutex;
+
+    /// File handler, NULL if not opened yet
+    std::unique_ptr<TFile> file;
+  };
+
+  /// Load histogram from the snapshot if available there, else from the input file (returns NULL if it does not exist)
+  TH1* load(const TString& fileName, const TString& histoName, const Systematic::Systematic& systematic,
+            const HistogramSnapshot* snapshot, InputFile& inputFile)const;
+
+  /// Snapshot to take histograms from, NULL if not set
+  const HistogramSnapshot* snapshot_;
+
+  /// Cached histograms, also holding non-existing ones (as NULL) to avoid repeated lookups
+  std::map<Key, std::unique_ptr<Entry> > histograms_;
+
+  /// Input root files per file name
+  std::map<std::string, std::unique_ptr<InputFile> > inputFiles_;
+
+  /// Protects the maps of histograms and input files and the snapshot pointer, not the loading
+  std::mutex mutex_;
+};
+
+
+
+
+
+#endif
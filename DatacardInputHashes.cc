@@ -0,0 +1,82 @@
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include "DatacardInputHashes.h"
+#include "DatacardManifest.h"
+
+
+
+
+
+DatacardInputHashes::DatacardInputHashes(const std::string& fileName):
+fileName_(fileName)
+{
+  std::ifstream file(fileName_.c_str());
+
+  // One record per line: directory, input, file hash, content hash
+  std::string line;
+  while(std::getline(file, line)){
+    std::istringstream record(line);
+    std::string directory, input;
+    uint64_t fileHash(0), contentHash(0);
+    if(record >> directory >> input >> std::hex >> fileHash >> contentHash){
+      records_[std::make_pair(directory, input)] = std::make_pair(fileHash, contentHash);
+    }
+  }
+}
+
+
+
+bool DatacardInputHashes::find(const std::string& directory, const std::string& input, uint64_t& fileHash, uint64_t& contentHash)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto record = records_.find(std::make_pair(directory, input));
+  if(record == records_.end()) return false;
+
+  fileHash = record->second.first;
+  contentHash = record->second.second;
+  return true;
+}
+
+
+
+void DatacardInputHashes::set(const std::string& directory, const std::string& input, const uint64_t fileHash, const uint64_t contentHash)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  records_[std::make_pair(directory, input)] = std::make_pair(fileHash, contentHash);
+}
+
+
+
+bool DatacardInputHashes::save()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::ofstream file(fileName_.c_str(), std::ios::trunc);
+  for(const auto& record : records_){
+    file << record.first.first << "\t" << record.first.second << "\t"
+         << std::hex << record.second.first << "\t" << record.second.second << std::dec << "\n";
+  }
+  file.close();
+
+  if(!file){
+    std::cerr << "Warning in DatacardInputHashes! Cannot write file: " << fileName_ << std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+
+uint64_t DatacardInputHashes::fileHash(const std::string& fileName)
+{
+  DatacardManifest::FileStamp stamp;
+  if(!DatacardManifest::fileStamp(fileName, stamp)) return 0;
+
+  uint64_t hash = DatacardManifest::hash(fileName);
+  hash = DatacardManifest::hash(std::to_string(static_cast<long long>(stamp.first)), hash);
+  hash = DatacardManifest::hash(std::to_string(static_cast<unsigned long long>(stamp.second)), hash);
+  return hash;
+}
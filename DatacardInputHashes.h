@@ -0,0 +1,59 @@
+#ifndef DatacardInputHashes_h
+#define DatacardInputHashes_h
+
+#include <map>
+#include <string>
+#include <utility>
+#include <mutex>
+#include <cstdint>
+
+
+
+
+
+/// Record of the inputs the datacards of one output root file were produced from, stored as text file next to it
+/// Per datacard directory and input (e.g. a systematic), it holds a hash of the input file name, modification time and size,
+/// and a hash of the content of the input histograms, which allows to regenerate only outputs whose inputs changed
+/// Access is thread safe
+class DatacardInputHashes{
+
+ public:
+
+  /// Constructor, reading the records of a previous run if the file exists
+  explicit DatacardInputHashes(const std::string& fileName);
+
+  /// Destructor
+  ~DatacardInputHashes(){}
+
+  /// Recorded hashes of the input of the datacard directory, returns false if there is no record
+  bool find(const std::string& directory, const std::string& input, uint64_t& fileHash, uint64_t& contentHash);
+
+  /// Record hashes of the input of the datacard directory
+  void set(const std::string& directory, const std::string& input, const uint64_t fileHash, const uint64_t contentHash);
+
+  /// Write all records to file, returns false if writing failed
+  bool save();
+
+  /// Hash of the name, modification time and size of the file, 0 if it does not exist
+  static uint64_t fileHash(const std::string& fileName);
+
+ private:
+
+  DatacardInputHashes(const DatacardInputHashes&) = delete;
+  DatacardInputHashes& operator=(const DatacardInputHashes&) = delete;
+
+  /// Name of the file holding the records
+  const std::string fileName_;
+
+  /// File and content hash, per datacard directory and input
+  std::map<std::pair<std::string, std::string>, std::pair<uint64_t, uint64_t> > records_;
+
+  /// Protects the records
+  std::mutex mutex_;
+};
+
+
+
+
+
+#endif
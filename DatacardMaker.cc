@@ -21,6 +21,10 @@
 #include <TError.h>
 
 #include "DatacardMaker.h"
+#include "BinByBinStatEngine.h"
+#include "HistogramAccumulator.h"
+#include "DatacardInputHashes.h"
+#include "DatacardProfiler.h"
 #include "AnalysisConfig.h"
 #include "higgsUtils.h"
 #include "Samples.h"
@@ -31,7 +35,6 @@
 #include "HistoListReader.h"
 
 #include <TList.h>
-#include <TKey.h>
 #include <TIterator.h>
 #include <TObject.h>
 #include <TObjString.h>
@@ -50,6 +53,10 @@
 
 
 
+// Config name for input names given explicitly instead of read from a HistoList config
+static const std::string noHistoListConfig("");
+
+
 // Aids the find algorithm to access the first element of the pair object    
 struct comp
 {
@@ -63,19 +70,6 @@ struct comp
 };
 
 
-struct compare
-{
-  compare(std::string const& s, std::string const& t) : _s(s),_t(t) { }
-
-  bool operator () (std::pair<std::string, std::string> const& p) {
-    return ((p.first == _s) && (p.second == _t));
-  }
-
-  std::string _s;
-  std::string _t;
-};
-
-
 DatacardMaker::DatacardMaker(const AnalysisConfig& analysisConfig,
                              const std::vector<std::string>& v_plot,
                              const std::vector<Channel::Channel>& v_channel,
@@ -87,18 +81,18 @@ DatacardMaker::DatacardMaker(const AnalysisConfig& analysisConfig,
   configname_(configname),
   outputBaseDir_("datacards"),
   outputFileName_("common/ttH_hbb_13TeV_dl.root"),
+  manifestFileName_(std::string(outputBaseDir_)+"/datacardManifest.bin"),
   addSystematicUncertainty_(true),
   addStatisticalUncertainty_(true),
   analysisConfig_(analysisConfig),
-  inputFileLists_(NULL),
   fileReader_(RootFileReader::getInstance()),
-  eventFileString_(""),
-  datacardName_(""),
-  datacard_(NULL),
-  outputDirDatacard_(""),
-  outputFile_(NULL),
   observableType_("BDT"),
   pruneBinByBin_(false),
+  numberOfThreads_(1),
+  statisticalUncertaintyMode_(binByBin),
+  autoMCStatsThreshold_(10.),
+  incremental_(false),
+  systematicColumns_(0),
   v_plot_(v_plot),
   v_channel_(v_channel),
   v_systematic_(v_systematic)
@@ -107,67 +101,121 @@ DatacardMaker::DatacardMaker(const AnalysisConfig& analysisConfig,
   if(analysisConfig_.general().era_ != Era::run1_8tev)
     initialization13TeV(pruneBinByBin_);
 
+  // Input names given explicitly, set by the delegating constructor
+  if(configname_.empty()) return;
+
   // Setting the list of names of the input root files and processes (e.g. ttH & ttbar+XX) to be used
   const std::string histoListFile(tth::DATA_PATH_TTH() + "/" + configname_);
   std::cout << histoListFile << std::endl;
 
-  const HistoListReader histoList(histoListFile.data());
-
-  if(histoList.isZombie()){
-    std::cerr << "Error in Histo! Cannot find HistoList with name: " << histoListFile << "\n...break\n" << std::endl;
-    exit(12);      
+  // Identify the query by everything the resolved inputs depend on
+  uint64_t queryHash = DatacardManifest::hash(configname_);
+  queryHash = DatacardManifest::hash(fileList_base_.Data(), queryHash);
+  queryHash = DatacardManifest::hash(std::to_string(static_cast<int>(analysisConfig_.general().era_)), queryHash);
+  for(const auto& plot : v_plot_) queryHash = DatacardManifest::hash(plot, queryHash);
+
+  // Take the process and input file names from the manifest of a previous run if nothing changed since
+  if(manifest_.load(manifestFileName_, queryHash)) {
+    std::cout << "Using manifest: " << manifestFileName_ << std::endl;
+    processNames_ = manifest_.processNames();
+    fileNames_ = manifest_.fileNames();
   }
+  else {
+    const HistoListReader histoList(histoListFile.data());
+
+    if(histoList.isZombie()){
+      std::cerr << "Error in Histo! Cannot find HistoList with name: " << histoListFile << "\n...break\n" << std::endl;
+      exit(12);      
+    }
   
-  // Loop over all histograms in histoList and print them  
-  for(auto it = histoList.begin(); it != histoList.end(); ++it){
+    // Loop over all histograms in histoList and print them  
+    for(auto it = histoList.begin(); it != histoList.end(); ++it){
     
-    // Access plot properties from histoList and check whether histogram name contains name pattern      
-    const PlotProperties& plotProperties = it->second;
+      // Access plot properties from histoList and check whether histogram name contains name pattern      
+      const PlotProperties& plotProperties = it->second;
 
-    std::cout << "checking " << plotProperties.name << std::endl;
+      std::cout << "checking " << plotProperties.name << std::endl;
     
-    bool found = false;
+      bool found = false;
     
-    for(const auto& plot : v_plot_){
+      for(const auto& plot : v_plot_){
       
-      if(plot.size() && plot[0] == '+'){
+        if(plot.size() && plot[0] == '+'){
         
-        if(plotProperties.name.CompareTo(&plot[1], TString::kIgnoreCase) == 0){
-          found = true;                                                                                                                                     
+          if(plotProperties.name.CompareTo(&plot[1], TString::kIgnoreCase) == 0){
+            found = true;                                                                                                                                     
+            break;
+          }  
+        }
+        else if(plotProperties.name.Contains(plot, TString::kIgnoreCase)){
+          found = true;
           break;
-        }  
+        }
       }
-      else if(plotProperties.name.Contains(plot, TString::kIgnoreCase)){
-        found = true;
-        break;
+      if(!found){ 
+        std::cout << "... no histograms found, continue with next\n";
+        continue;
       }
-    }
-    if(!found){ 
-      std::cout << "... no histograms found, continue with next\n";
-      continue;
-    }
     
-    std::cout << "finished checking " << plotProperties.name << "\n\n";
+      std::cout << "finished checking " << plotProperties.name << "\n\n";
     
-    processNames_.clear();
+      processNames_.clear();
     
-    TObjArray* strings = plotProperties.specialComment.Tokenize(" ");
+      TObjArray* strings = plotProperties.specialComment.Tokenize(" ");
     
-    for(std::size_t i = 0; i < (std::size_t)strings->GetEntries(); ++i) {
+      for(std::size_t i = 0; i < (std::size_t)strings->GetEntries(); ++i) {
 
-      std::string sample = ((TObjString*)strings->At(i))->GetString().Data();
+        std::string sample = ((TObjString*)strings->At(i))->GetString().Data();
       
-      if(std::find_if(convertSampleNames_.begin(), convertSampleNames_.end(), comp(sample)) !=  convertSampleNames_.end())
-        processNames_.push_back(sample);
-      else 
-        continue;
+        if(std::find_if(convertSampleNames_.begin(), convertSampleNames_.end(), comp(sample)) !=  convertSampleNames_.end())
+          processNames_.push_back(sample);
+        else 
+          continue;
+      }
+      fileNames_.push_back(plotProperties.name.Data());
     }
-    fileNames_.push_back(plotProperties.name.Data());
+
+    manifest_.addDependency(histoListFile);
+    manifest_.setHistoList(processNames_, fileNames_);
   }
 
+  // Pre-format the systematic uncertainty block, identical for all datacards
+  initializeSystematicMatrix();
 }
 
 
+DatacardMaker::DatacardMaker(const AnalysisConfig& analysisConfig,
+                             const std::vector<std::string>& fileNames,
+                             const std::vector<std::string>& processNames,
+                             const std::vector<Channel::Channel>& v_channel,
+                             const std::vector<Systematic::Systematic>& v_systematic,
+                             const std::string& fileLists) :
+  DatacardMaker(analysisConfig, fileNames, v_channel, v_systematic, fileLists, noHistoListConfig)
+{
+  fileNames_ = fileNames;
+
+  // Only processes with a datacard label can be used
+  for(const auto& process : processNames) {
+    if(std::find_if(convertSampleNames_.begin(), convertSampleNames_.end(), comp(process)) != convertSampleNames_.end())
+      processNames_.push_back(process);
+  }
+
+  initializeSystematicMatrix();
+}
+
+
+DatacardMaker::DatacardJob::DatacardJob(const std::string& name_, const Channel::Channel& channel_):
+  name(name_),
+  channel(channel_),
+  category(""),
+  directory(""),
+  outputDir(""),
+  datacardName(""),
+  inputHashes(NULL),
+  rebuild(true)
+{}
+
+
 void DatacardMaker::initialization13TeV(bool pruneOption)
 {
   // Set prunning option
@@ -406,76 +454,26 @@ void DatacardMaker::initialization13TeV(bool pruneOption)
   convertSystematicLabel_["LEPT_UP"]   = "CMS_ttHbb_eff_leptonUp";
   convertSystematicLabel_["LEPT_DOWN"] = "CMS_ttHbb_eff_leptonDown";
 
-  convertSystematicLabel_["JESAbsoluteStat_UP"]   = "CMS_scaleAbsoluteStat_jUp";
-  convertSystematicLabel_["JESAbsoluteStat_DOWN"] = "CMS_scaleAbsoluteStat_jDown";
-  convertSystematicLabel_["JESAbsoluteScale_UP"]   = "CMS_scaleAbsoluteScale_jUp";
-  convertSystematicLabel_["JESAbsoluteScale_DOWN"] = "CMS_scaleAbsoluteScale_jDown";
-  convertSystematicLabel_["JESAbsoluteFlavMap_UP"]   = "CMS_scaleAbsoluteFlavMap_jUp";
-  convertSystematicLabel_["JESAbsoluteFlavMap_DOWN"] = "CMS_scaleAbsoluteFlavMap_jDown";
-  convertSystematicLabel_["JESAbsoluteMPFBias_UP"]   = "CMS_scaleAbsoluteMPFBias_jUp";
-  convertSystematicLabel_["JESAbsoluteMPFBias_DOWN"] = "CMS_scaleAbsoluteMPFBias_jDown";
-  convertSystematicLabel_["JESFragmentation_UP"]   = "CMS_scaleFragmentation_jUp";
-  convertSystematicLabel_["JESFragmentation_DOWN"] = "CMS_scaleFragmentation_jDown";
-  convertSystematicLabel_["JESSinglePionECAL_UP"]   = "CMS_scaleSinglePionECAL_jUp";
-  convertSystematicLabel_["JESSinglePionECAL_DOWN"] = "CMS_scaleSinglePionECAL_jDown";
-  convertSystematicLabel_["JESSinglePionHCAL_UP"]   = "CMS_scaleSinglePionHCAL_jUp";
-  convertSystematicLabel_["JESSinglePionHCAL_DOWN"] = "CMS_scaleSinglePionHCAL_jDown";
-  convertSystematicLabel_["JESFlavorQCD_UP"]   = "CMS_scaleFlavorQCD_jUp";
-  convertSystematicLabel_["JESFlavorQCD_DOWN"] = "CMS_scaleFlavorQCD_jDown";
-  convertSystematicLabel_["JESRelativeJEREC1_UP"]   = "CMS_scaleRelativeJEREC1_jUp";
-  convertSystematicLabel_["JESRelativeJEREC1_DOWN"] = "CMS_scaleRelativeJEREC1_jDown";
-  convertSystematicLabel_["JESRelativeJEREC2_UP"]   = "CMS_scaleRelativeJEREC2_jUp";
-  convertSystematicLabel_["JESRelativeJEREC2_DOWN"] = "CMS_scaleRelativeJEREC2_jDown";
-  convertSystematicLabel_["JESRelativeJERHF_UP"]   = "CMS_scaleRelativeJERHF_jUp";
-  convertSystematicLabel_["JESRelativeJERHF_DOWN"] = "CMS_scaleRelativeJERHF_jDown";
-  convertSystematicLabel_["JESRelativePtBB_UP"]   = "CMS_scaleRelativePtBB_jUp";
-  convertSystematicLabel_["JESRelativePtBB_DOWN"] = "CMS_scaleRelativePtBB_jDown";
-  convertSystematicLabel_["JESRelativePtEC1_UP"]   = "CMS_scaleRelativePtEC1_jUp";
-  convertSystematicLabel_["JESRelativePtEC1_DOWN"] = "CMS_scaleRelativePtEC1_jDown";
-  convertSystematicLabel_["JESRelativePtEC2_UP"]   = "CMS_scaleRelativePtEC2_jUp";
-  convertSystematicLabel_["JESRelativePtEC2_DOWN"] = "CMS_scaleRelativePtEC2_jDown";
-  convertSystematicLabel_["JESRelativePtHF_UP"]   = "CMS_scaleRelativePtHF_jUp";
-  convertSystematicLabel_["JESRelativePtHF_DOWN"] = "CMS_scaleRelativePtHF_jDown";
-  convertSystematicLabel_["JESRelativeFSR_UP"]   = "CMS_scaleRelativeFSR_jUp";
-  convertSystematicLabel_["JESRelativeFSR_DOWN"] = "CMS_scaleRelativeFSR_jDown";
-  convertSystematicLabel_["JESRelativeStatFSR_UP"]   = "CMS_scaleRelativeStatFSR_jUp";
-  convertSystematicLabel_["JESRelativeStatFSR_DOWN"] = "CMS_scaleRelativeStatFSR_jDown";
-  convertSystematicLabel_["JESRelativeStatEC_UP"]   = "CMS_scaleRelativeStatEC_jUp";
-  convertSystematicLabel_["JESRelativeStatEC_DOWN"] = "CMS_scaleRelativeStatEC_jDown";
-  convertSystematicLabel_["JESRelativeStatHF_UP"]   = "CMS_scaleRelativeStatHF_jUp";
-  convertSystematicLabel_["JESRelativeStatHF_DOWN"] = "CMS_scaleRelativeStatHF_jDown";
-  convertSystematicLabel_["JESRelativeBal_UP"]   = "CMS_scaleRelativeBal_jUp";
-  convertSystematicLabel_["JESRelativeBal_DOWN"] = "CMS_scaleRelativeBal_jDown";
-  convertSystematicLabel_["JESPileUpDataMC_UP"]   = "CMS_scalePileUpDataMC_jUp";
-  convertSystematicLabel_["JESPileUpDataMC_DOWN"] = "CMS_scalePileUpDataMC_jDown";
-  convertSystematicLabel_["JESPileUpPtRef_UP"]   = "CMS_scalePileUpPtRef_jUp";
-  convertSystematicLabel_["JESPileUpPtRef_DOWN"] = "CMS_scalePileUpPtRef_jDown";
-  convertSystematicLabel_["JESPileUpPtEC1_UP"]   = "CMS_scalePileUpPtEC1_jUp";
-  convertSystematicLabel_["JESPileUpPtEC1_DOWN"] = "CMS_scalePileUpPtEC1_jDown";
-  convertSystematicLabel_["JESPileUpPtEC2_UP"]   = "CMS_scalePileUpPtEC2_jUp";
-  convertSystematicLabel_["JESPileUpPtEC2_DOWN"] = "CMS_scalePileUpPtEC2_jDown";
-  convertSystematicLabel_["JESPileUpPtHF_UP"]   = "CMS_scalePileUpPtHF_jUp";
-  convertSystematicLabel_["JESPileUpPtHF_DOWN"] = "CMS_scalePileUpPtHF_jDown";  
-  convertSystematicLabel_["JESPileUpPtBB_UP"]   = "CMS_scalePileUpPtBB_jUp";
-  convertSystematicLabel_["JESPileUpPtBB_DOWN"] = "CMS_scalePileUpPtBB_jDown";
-  convertSystematicLabel_["JESPileUpMuZero_UP"]   = "CMS_scalePileUpMuZero_jUp";
-  convertSystematicLabel_["JESPileUpMuZero_DOWN"] = "CMS_scalePileUpMuZero_jDown";
-  convertSystematicLabel_["JESPileUpEnvelope_UP"]   = "CMS_scalePileUpEnvelope_jUp";
-  convertSystematicLabel_["JESPileUpEnvelope_DOWN"] = "CMS_scalePileUpEnvelope_jDown";
-  convertSystematicLabel_["JESFlavorZJet_UP"]   = "CMS_scaleFlavorZJet_jUp";
-  convertSystematicLabel_["JESFlavorZJet_DOWN"] = "CMS_scaleFlavorZJet_jDown";
-  convertSystematicLabel_["JESFlavorPhotonJet_UP"]   = "CMS_scaleFlavorPhotonJet_jUp";
-  convertSystematicLabel_["JESFlavorPhotonJet_DOWN"] = "CMS_scaleFlavorPhotonJet_jDown";
-  convertSystematicLabel_["JESFlavorPureGluon_UP"]   = "CMS_scaleFlavorPureGluon_jUp";
-  convertSystematicLabel_["JESFlavorPureGluon_DOWN"] = "CMS_scaleFlavorPureGluon_jDown";
-  convertSystematicLabel_["JESFlavorPureQuark_UP"]   = "CMS_scaleFlavorPureQuark_jUp";
-  convertSystematicLabel_["JESFlavorPureQuark_DOWN"] = "CMS_scaleFlavorPureQuark_jDown";
-  convertSystematicLabel_["JESFlavorPureCharm_UP"]   = "CMS_scaleFlavorPureCharm_jUp";
-  convertSystematicLabel_["JESFlavorPureCharm_DOWN"] = "CMS_scaleFlavorPureCharm_jDown";
-  convertSystematicLabel_["JESFlavorPureBottom_UP"]   = "CMS_scaleFlavorPureBottom_jUp";
-  convertSystematicLabel_["JESFlavorPureBottom_DOWN"] = "CMS_scaleFlavorPureBottom_jDown";
-  convertSystematicLabel_["JESTimePtEta_UP"]   = "CMS_scaleTimePtEta_jUp";
-  convertSystematicLabel_["JESTimePtEta_DOWN"] = "CMS_scaleTimePtEta_jDown";
+  // Split JES uncertainty sources, all of type "shape" and applied to all processes (add new sources here)
+  const std::vector<std::string> jesSources = {
+    "AbsoluteStat", "AbsoluteScale", "AbsoluteFlavMap", "AbsoluteMPFBias",
+    "Fragmentation", "SinglePionECAL", "SinglePionHCAL", "FlavorQCD",
+    "RelativeJEREC1", "RelativeJEREC2", "RelativeJERHF",
+    "RelativePtBB", "RelativePtEC1", "RelativePtEC2", "RelativePtHF",
+    "RelativeFSR", "RelativeStatFSR", "RelativeStatEC", "RelativeStatHF", "RelativeBal",
+    "PileUpDataMC", "PileUpPtRef", "PileUpPtEC1", "PileUpPtEC2", "PileUpPtHF", "PileUpPtBB",
+    "PileUpMuZero", "PileUpEnvelope",
+    "FlavorZJet", "FlavorPhotonJet", "FlavorPureGluon", "FlavorPureQuark", "FlavorPureCharm", "FlavorPureBottom",
+    "TimePtEta",
+  };
+
+  for(const std::string& source : jesSources) {
+    convertSystematicLabel_["JES"+source+"_UP"]   = "CMS_scale"+source+"_jUp";
+    convertSystematicLabel_["JES"+source+"_DOWN"] = "CMS_scale"+source+"_jDown";
+    listOfSystematicsByType_.push_back(std::make_pair("JES"+source,"shape"));
+    valueOfSystematicBasedOnProcess_["JES"+source].push_back(std::make_pair("all","1.000000"));
+  }
+
 
   // Indicate if systematic uncertainty is of type "shape" or "lnN"
   listOfSystematicsByType_.push_back(std::make_pair("BTAGDISCR_BPURITY","shape"));
@@ -550,42 +548,6 @@ void DatacardMaker::initialization13TeV(bool pruneOption)
   listOfSystematicsByType_.push_back(std::make_pair("LEPT","shape"));
   listOfSystematicsByType_.push_back(std::make_pair("PDF","shape"));
 
-  listOfSystematicsByType_.push_back(std::make_pair("JESAbsoluteStat","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESAbsoluteScale","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESAbsoluteFlavMap","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESAbsoluteMPFBias","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESFragmentation","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESSinglePionECAL","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESSinglePionHCAL","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESFlavorQCD","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESRelativeJEREC1","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESRelativeJEREC2","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESRelativeJERHF","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESRelativePtBB","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESRelativePtEC1","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESRelativePtEC2","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESRelativePtHF","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESRelativeFSR","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESRelativeStatFSR","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESRelativeStatEC","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESRelativeStatHF","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESRelativeBal","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESPileUpDataMC","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESPileUpPtRef","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESPileUpPtEC1","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESPileUpPtEC2","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESPileUpPtHF","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESPileUpMuZero","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESPileUpEnvelope","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESPileUpPtBB","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESFlavorZJet","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESFlavorPhotonJet","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESFlavorPureGluon","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESFlavorPureQuark","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESFlavorPureCharm","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESFlavorPureBottom","shape"));
-  listOfSystematicsByType_.push_back(std::make_pair("JESTimePtEta","shape"));
-
   // Those of type lnN
   listOfSystematicsByType_.push_back(std::make_pair("LUMI","lnN"));
   listOfSystematicsByType_.push_back(std::make_pair("NORMPDFGG","lnN"));
@@ -889,126 +851,65 @@ void DatacardMaker::initialization13TeV(bool pruneOption)
   valueOfSystematicBasedOnProcess_["LEPT"].push_back(std::make_pair("all","1.000000"));
   //valueOfSystematicBasedOnProcess_["LEPT"].push_back(std::make_pair("all","1.040000"));
 
-  valueOfSystematicBasedOnProcess_["JESAbsoluteStat"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESAbsoluteScale"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESAbsoluteFlavMap"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESAbsoluteMPFBias"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESFragmentation"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESSinglePionECAL"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESSinglePionHCAL"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESFlavorQCD"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESRelativeJEREC1"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESRelativeJEREC2"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESRelativeJERHF"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESRelativePtBB"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESRelativePtEC1"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESRelativePtEC2"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESRelativePtHF"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESRelativeFSR"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESRelativeStatFSR"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESRelativeStatEC"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESRelativeStatHF"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESRelativeBal"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESPileUpDataMC"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESPileUpPtRef"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESPileUpPtEC1"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESPileUpPtEC2"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESPileUpPtHF"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESPileUpPtBB"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESPileUpMuZero"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESPileUpEnvelope"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESFlavorZJet"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESFlavorPhotonJet"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESFlavorPureGluon"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESFlavorPureQuark"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESFlavorPureCharm"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESFlavorPureBottom"].push_back(std::make_pair("all","1.000000"));
-  valueOfSystematicBasedOnProcess_["JESTimePtEta"].push_back(std::make_pair("all","1.000000"));
+  // Build classification table by systematic type from the lists above
+  initializeSystematicClassification();
 
 }
 
 
 void DatacardMaker::writeDatacards()
 {
-  std::map<Channel::Channel, std::map<Systematic::Systematic, std::map<std::string,std::string > > > m_inputRootFileNames; 
+  DatacardProfiler::Scope profile("writeDatacards");
 
-  // Set up systematic variations
-  std::vector<Systematic::Variation> v_variation;
-  v_variation.push_back(Systematic::Variation::up);
-  v_variation.push_back(Systematic::Variation::down);
-
-  for(auto fileNamesConfig : fileNames_) {    
+  // Force all histograms to use option Sumw2(), to switch histogram errors
+  TH1::SetDefaultSumw2();
 
-    for(Channel::Channel channel : v_channel_) { 
+  // Worker threads producing the datacards, and a single writer thread serializing all access to the output root files
+  const size_t numberOfWorkers = numberOfThreads_ > 1 ? numberOfThreads_ : 0;
+  if(numberOfWorkers) ROOT::EnableThreadSafety();
 
-      for(Systematic::Systematic systematic : v_systematic_) {   
-      
-        // Constructing a neutral systematic for which two variations will be stored             
-        Systematic::Systematic systematicToStore = Systematic::Systematic(systematic.type(), Systematic::undefinedVariation, systematic.variationNumber());
-        TString inputFileListName;
-
-        if(systematic.type() == Systematic::scale_ttb       || systematic.type() == Systematic::scale_ttbb  || systematic.type() == Systematic::scale_tt2b
-           || systematic.type() == Systematic::scale_ttcc   || systematic.type() == Systematic::scale_ttother) {
-          TString tmp = systematic.name().Contains("_UP") ? "SCALE_UP" : "SCALE_DOWN";
-          inputFileListName = fileList_base_+"/"+"HistoFileList_"+tmp+"_"+Channel::convert(channel)+".txt";
-        }
-        else if(systematic.type() == Systematic::meScale_ttb     || systematic.type() == Systematic::meScale_ttbb  || systematic.type() == Systematic::meScale_tt2b
-                || systematic.type() == Systematic::meScale_ttcc || systematic.type() == Systematic::meScale_ttother) {
-          TString tmp = systematic.name().Contains("_UP") ? "MESCALE_UP" : "MESCALE_DOWN";
-          inputFileListName = fileList_base_+"/"+"HistoFileList_"+tmp+"_"+Channel::convert(channel)+".txt";
-        }
-        else if(systematic.type() == Systematic::psScale_ttb     || systematic.type() == Systematic::psScale_ttbb  || systematic.type() == Systematic::psScale_tt2b || systematic.type() == Systematic::psScale_ttcc || systematic.type() == Systematic::psScale_ttother) {
-          TString tmp = systematic.name().Contains("_UP") ? "PSSCALE_UP" : "PSSCALE_DOWN";
-          inputFileListName = fileList_base_+"/"+"HistoFileList_"+tmp+"_"+Channel::convert(channel)+".txt";
-        }
-        else {
-          inputFileListName = fileList_base_+"/"+"HistoFileList_"+systematic.name()+"_"+Channel::convert(channel)+".txt";
-        }
+  ThreadPool workers(numberOfWorkers);
+  writer_.reset(new ThreadPool(numberOfWorkers ? 1 : 0));
 
-        std::ifstream file(inputFileListName.Data());
-      
-        std::string lnN("lnN");
-        TString lnNTypeUncertain = systematic.name().Contains("_UP") ? systematic.name().ReplaceAll("_UP","") : systematic.name().ReplaceAll("_DOWN","");
+  // Input histograms from a snapshot of a previous run, skipping ROOT deserialization
+  if(!snapshotInputFile_.empty()) {
+    snapshot_.reset(new HistogramSnapshot(snapshotInputFile_));
+    if(snapshot_->isZombie()) {
+      std::cerr << "Error in DatacardMaker! Cannot read histogram snapshot: " << snapshotInputFile_ << "\n...break\n" << std::endl;
+      exit(14);
+    }
+    const std::vector<std::string> staleInputFiles = snapshot_->staleInputFiles();
+    if(!staleInputFiles.empty()) {
+      std::cerr << "Error in DatacardMaker! Histogram snapshot is outdated: " << snapshotInputFile_ << "\n...changed input files:\n";
+      for(const std::string& inputFile : staleInputFiles) std::cerr << "\t" << inputFile << "\n";
+      std::cerr << "...export a new snapshot, break\n" << std::endl;
+      exit(14);
+    }
+    std::cout << "Using histogram snapshot: " << snapshotInputFile_ << " (" << snapshot_->size() << " histograms)" << std::endl;
+    histogramCache_.setSnapshot(snapshot_.get());
+  }
 
-        // Check if systematic type is lnN (i.e. rate) if so skip
-        if(std::find_if(listOfSystematicsByType_.begin(),listOfSystematicsByType_.end(),compare(lnNTypeUncertain.Data(),lnN)) != listOfSystematicsByType_.end()) {
-          continue;
-        }       
+  // One datacard per event category and channel
+  std::vector<std::unique_ptr<DatacardJob> > jobs;
 
-        if(!file) {
-          std::cerr << "### File list not found: " << inputFileListName << " Breaking...\n\n";
-          exit(1);
-        }
-        // Reading each line of the file corresponding to a separate histogram
-        std::string line_;
-        
-        while(std::getline(file, line_)) {   
-          std::string fileNameWithDirPath(line_);
+  // Everything the datacards depend on apart from the input histograms, to detect changes in incremental mode
+  const uint64_t configurationHash = this->configurationHash();
 
-          // Extracting the histogram name
-          std::size_t found = std::string(fileNameWithDirPath).find_last_of("/\\");
-          std::string fileName(std::string(fileNameWithDirPath).substr(found+1));
+  for(auto fileNamesConfig : fileNames_) {    
 
-          if(TString(fileName).Contains(fileNamesConfig)) {
-            m_inputRootFileNames[channel][systematic][fileName] = fileNameWithDirPath;
-            inputFileLists_ = &m_inputRootFileNames;
-          }
-        }
-      }
-   
-      TString labelString;
-      TObjString labels;
+    for(Channel::Channel channel : v_channel_) { 
 
-      // Fill maps and meta information
-      for(auto convertedSysLabel : convertSystematicLabel_) {
-        labelString  += TString::Format("%s\t%s\n", (convertedSysLabel.first).c_str(), (convertedSysLabel.second).c_str());
-      }
+      jobs.emplace_back(new DatacardJob(fileNamesConfig, channel));
+      DatacardJob& job = *jobs.back();
 
       TObjArray* token  = TString(fileNamesConfig).Tokenize("_");
-      TString filename  = TString(fileNamesConfig);
       TString eventCategory  = ((TObjString*)token->At(token->GetLast()))->GetString();
+      delete token;
+
+      job.category  = mapOfCategories_[eventCategory.Data()];
+      job.directory = job.category+"_"+observableType_;
 
-      // Begin creating directory structure
+      // Begin creating directory structure, done serially before any datacard is written
       TString path("");
     
       // Create all subdirectories contained in output baseDir
@@ -1019,779 +920,760 @@ void DatacardMaker::writeDatacards()
         path.Append("/");
         gSystem->MakeDirectory(path);
       }
+      delete a_currentDir;
 
       // Create subdirectories for channel
       path.Append(Channel::convert(channel));
       path.Append("/");
       gSystem->MakeDirectory(path);
 
-      outputDirDatacard_ = path;
+      job.outputDir = path;
 
       // Set datacard outfile name with partial directory path
-      eventFileString_   = outputDirDatacard_+"ttH_hbb_13TeV_"+mapOfCategories_[eventCategory.Data()];
-      datacardName_      = eventFileString_+".txt";
+      job.datacardName = job.outputDir+"ttH_hbb_13TeV_"+job.category+".txt";
 
       // Create directory for output root file storage
-      gSystem->MakeDirectory(TString(outputDirDatacard_+"common"));
-      
-      std::cout << "\nOpening file: " << datacardName_ << std::endl;
-
-      // Update (i.e. append) to output file      
-      if(!outputFile_) {
-        outputFile_ = new TFile(TString(outputDirDatacard_+outputFileName_),"NEW");
-      }
-      else {
-        outputFile_ = new TFile(TString(outputDirDatacard_+outputFileName_),"UPDATE"); 
-      }
-
-      // Write histograms to correct event category directory
-      if(outputFile_->GetDirectory(TString(mapOfCategories_[eventCategory.Data()]+"_"+observableType_))) {
-        outputFile_->cd(TString(mapOfCategories_[eventCategory.Data()]+"_"+observableType_));
-      }                                                                                 
-      else {
-        outputFile_->mkdir(TString(mapOfCategories_[eventCategory.Data()]+"_"+observableType_), TString(mapOfCategories_[eventCategory.Data()]+"_"+observableType_));
-        outputFile_->cd(TString(mapOfCategories_[eventCategory.Data()]+"_"+observableType_));
+      gSystem->MakeDirectory(TString(job.outputDir+"common"));
+
+      // Incremental mode: the datacard is rebuilt completely only if the configuration or its outputs changed
+      if(incremental_) {
+        const std::string rootFileName(job.outputDir+outputFileName_);
+        std::unique_ptr<DatacardInputHashes>& inputHashes = inputHashes_[rootFileName];
+        if(!inputHashes) inputHashes.reset(new DatacardInputHashes(rootFileName+".hashes"));
+        job.inputHashes = inputHashes.get();
+
+        uint64_t recordedConfiguration(0), recordedDatacard(0);
+        job.rebuild = !inputHashes->find(job.directory, "#configuration", recordedConfiguration, recordedDatacard) ||
+                      recordedConfiguration != configurationHash ||
+                      recordedDatacard != DatacardInputHashes::fileHash(job.datacardName) ||
+                      !DatacardInputHashes::fileHash(rootFileName);
       }
+    }
+  }
 
-      // Fill meta information on what mapping labeling used
-      labels = labelString.Data();
-      labels.Write("MetaInfoLabelConvert",TObject::kOverwrite);
-      outputFile_->Close();
+  // Incremental mode: output root files only holding rebuilt datacards are recreated, which drops outputs not produced anymore
+  recreatedOutputFiles_.clear();
+  if(incremental_) {
+    std::map<std::string, bool> allRebuilt;
+    for(const auto& job : jobs) {
+      bool& rebuilt = allRebuilt.insert(std::make_pair(job->outputDir+outputFileName_, true)).first->second;
+      rebuilt = rebuilt && job->rebuild;
+    }
+    for(const auto& outputFile : allRebuilt) {
+      if(outputFile.second) recreatedOutputFiles_.insert(outputFile.first);
     }
+  }
 
-    // Start writing datacard
-    writeHeader(fileNamesConfig);
-    extractYields(fileNamesConfig);
+  // Read each file list once, before the datacards are produced, unless already known from the manifest
+  fileListIndex_.clear();
+  for(const auto& fileList : manifest_.fileLists()) fileListIndex_.addFileList(fileList.first, fileList.second);
 
-    if(!datacard_.is_open())
-      datacard_.open(datacardName_, std::ios::out | std::ios::app);
+  for(Channel::Channel channel : v_channel_) {
+    for(Systematic::Systematic systematic : v_systematic_) {
 
-    datacard_ << "#Source of uncertainty\t\t pdf\t\t";
+      // Check if systematic type is lnN (i.e. rate) if so skip
+      if(classification(systematic.type()).kind == lnN) continue;
 
-    for(auto process : processNames_) {
-      if(process != "allmc" && process != "data") {
-        datacard_ << TString::Format("%-8s\t", convertSampleNames_[process].c_str());
+      const TString fileListName = inputFileListName(channel, systematic);
+      if(!fileListIndex_.add(fileListName, channel, systematic)) {
+        std::cerr << "### File list not found: " << fileListName << " Breaking...\n\n";
+        exit(1);
       }
     }
-    datacard_ << std::endl;
+  }
 
-    writeYields(fileNamesConfig);
-    if(addSystematicUncertainty_) writeSystematicUncertainties();
-    if(addStatisticalUncertainty_) writeStatisticalUncertainties(fileNamesConfig);
+  for(const auto& fileList : fileListIndex_.fileLists()) {
+    manifest_.addDependency(fileList.first);
+    manifest_.setFileList(fileList.first, fileList.second);
+  }
 
-    bool append_to_datacard_systematic_group_labels(false);
+  for(auto& job : jobs) {
+    DatacardJob* const currentJob = job.get();
+    workers.submit([this, currentJob]{this->writeDatacard(*currentJob);});
+  }
+  workers.wait();
 
-    if(!datacard_.is_open())
-      datacard_.open(datacardName_, std::ios::out | std::ios::app);
+  // Write all buffered histograms and close the output root files
+  writer_->wait();
+  writer_.reset();
 
-    if(append_to_datacard_systematic_group_labels) {
+  for(auto& outputFile : outputFiles_) {
+    std::cout << "Writing file: " << outputFile.second->fileName() << std::endl;
+  }
+  {
+    DatacardProfiler::Scope profile("write", true);
+    outputFiles_.clear();
+  }
 
-      datacard_ << "\n"<< std::endl;
-      datacard_ << "exp group = lumi_13TeV_2016 CMS_res_j CMS_ttHbb_effTrigger_dl CMS_scaleAbsoluteMPFBias_j CMS_scaleAbsoluteScale_j CMS_scaleAbsoluteStat_j CMS_scaleFlavorQCD_j CMS_scaleFragmentation_j CMS_scalePileUpDataMC_j CMS_scalePileUpPtBB_j CMS_scalePileUpPtEC1_j CMS_scalePileUpPtEC2_j CMS_scalePileUpPtHF_j CMS_scalePileUpPtRef_j CMS_scaleRelativeBal_j CMS_scaleRelativeFSR_j CMS_scaleRelativeJEREC1_j CMS_scaleRelativeJEREC2_j CMS_scaleRelativeJERHF_j CMS_scaleRelativePtBB_j CMS_scaleRelativePtEC1_j CMS_scaleRelativePtEC2_j CMS_scaleRelativePtHF_j CMS_scaleRelativeStatEC_j CMS_scaleRelativeStatFSR_j CMS_scaleRelativeStatHF_j CMS_scaleSinglePionECAL_j CMS_scaleSinglePionHCAL_j CMS_scaleTimePtEta_j CMS_btag_lf CMS_btag_hf CMS_btag_hfstats1 CMS_btag_hfstats2 CMS_btag_cferr1 CMS_btag_cferr2 CMS_btag_lfstats1 CMS_btag_lfstats2 CMS_ttHbb_PU" << std::endl;
-      datacard_ << "syst group = QCDscale_V QCDscale_VV QCDscale_singlet QCDscale_ttH QCDscale_ttbar bgnorm_ttbarPlus2B bgnorm_ttbarPlusB bgnorm_ttbarPlusBBbar bgnorm_ttbarPlusCCbar pdf_gg pdf_qg pdf_qqbar pdf_Higgs_ttH lumi_13TeV_2016 CMS_res_j CMS_scaleAbsoluteMPFBias_j CMS_scaleAbsoluteScale_j CMS_scaleAbsoluteStat_j CMS_scaleFlavorQCD_j CMS_scaleFragmentation_j CMS_scalePileUpDataMC_j CMS_scalePileUpPtBB_j CMS_scalePileUpPtEC1_j CMS_scalePileUpPtEC2_j CMS_scalePileUpPtHF_j CMS_scalePileUpPtRef_j CMS_scaleRelativeBal_j CMS_scaleRelativeFSR_j CMS_scaleRelativeJEREC1_j CMS_scaleRelativeJEREC2_j CMS_scaleRelativeJERHF_j CMS_scaleRelativePtBB_j CMS_scaleRelativePtEC1_j CMS_scaleRelativePtEC2_j CMS_scaleRelativePtHF_j CMS_scaleRelativeStatEC_j CMS_scaleRelativeStatFSR_j CMS_scaleRelativeStatHF_j CMS_scaleSinglePionECAL_j CMS_scaleSinglePionHCAL_j CMS_scaleTimePtEta_j CMS_btag_lf CMS_btag_hf CMS_btag_hfstats1 CMS_btag_hfstats2 CMS_btag_cferr1 CMS_btag_cferr2 CMS_btag_lfstats1 CMS_btag_lfstats2 CMS_ttHbb_PU CMS_ttHbb_PDF CMS_ttHbb_scaleMuF CMS_ttHbb_scaleMuR CMS_ttHbb_UE_ttbarPlusBBbar CMS_ttHbb_UE_ttbarPlus2B CMS_ttHbb_UE_ttbarPlusB CMS_ttHbb_UE_ttbarPlusCCbar CMS_ttHbb_UE_ttbarOther CMS_ttHbb_ISR_ttbarPlusBBbar CMS_ttHbb_ISR_ttbarPlus2B CMS_ttHbb_ISR_ttbarPlusB CMS_ttHbb_ISR_ttbarPlusCCbar CMS_ttHbb_ISR_ttbarOther CMS_ttHbb_FSR_ttbarPlusBBbar CMS_ttHbb_FSR_ttbarPlus2B CMS_ttHbb_FSR_ttbarPlusB CMS_ttHbb_FSR_ttbarPlusCCbar CMS_ttHbb_FSR_ttbarOther CMS_ttHbb_HDAMP_ttbarPlusBBbar CMS_ttHbb_HDAMP_ttbarPlus2B CMS_ttHbb_HDAMP_ttbarPlusB CMS_ttHbb_HDAMP_ttbarPlusCCbar CMS_ttHbb_HDAMP_ttbarOther" << std::endl;
-      datacard_ << "jes group = CMS_scaleAbsoluteMPFBias_j CMS_scaleAbsoluteScale_j CMS_scaleAbsoluteStat_j CMS_scaleFlavorQCD_j CMS_scaleFragmentation_j CMS_scalePileUpDataMC_j CMS_scalePileUpPtBB_j CMS_scalePileUpPtEC1_j CMS_scalePileUpPtEC2_j CMS_scalePileUpPtHF_j CMS_scalePileUpPtRef_j CMS_scaleRelativeBal_j CMS_scaleRelativeFSR_j CMS_scaleRelativeJEREC1_j CMS_scaleRelativeJEREC2_j CMS_scaleRelativeJERHF_j CMS_scaleRelativePtBB_j CMS_scaleRelativePtEC1_j CMS_scaleRelativePtEC2_j CMS_scaleRelativePtHF_j CMS_scaleRelativeStatEC_j CMS_scaleRelativeStatFSR_j CMS_scaleRelativeStatHF_j CMS_scaleSinglePionECAL_j CMS_scaleSinglePionHCAL_j CMS_scaleTimePtEta_j" << std::endl;
-      datacard_<< "theory group = QCDscale_V QCDscale_VV QCDscale_singlet QCDscale_ttH QCDscale_ttbar bgnorm_ttbarPlus2B bgnorm_ttbarPlusB bgnorm_ttbarPlusBBbar bgnorm_ttbarPlusCCbar pdf_gg pdf_qg pdf_qqbar pdf_Higgs_ttH CMS_ttHbb_PDF CMS_ttHbb_scaleMuF CMS_ttHbb_scaleMuR CMS_ttHbb_UE_ttbarPlusBBbar CMS_ttHbb_UE_ttbarPlus2B CMS_ttHbb_UE_ttbarPlusB CMS_ttHbb_UE_ttbarPlusCCbar CMS_ttHbb_UE_ttbarOther CMS_ttHbb_ISR_ttbarPlusBBbar CMS_ttHbb_ISR_ttbarPlus2B CMS_ttHbb_ISR_ttbarPlusB CMS_ttHbb_ISR_ttbarPlusCCbar CMS_ttHbb_ISR_ttbarOther CMS_ttHbb_FSR_ttbarPlusBBbar CMS_ttHbb_FSR_ttbarPlus2B CMS_ttHbb_FSR_ttbarPlusB CMS_ttHbb_FSR_ttbarPlusCCbar CMS_ttHbb_FSR_ttbarOther CMS_ttHbb_HDAMP_ttbarPlusBBbar CMS_ttHbb_HDAMP_ttbarPlus2B CMS_ttHbb_HDAMP_ttbarPlusB CMS_ttHbb_HDAMP_ttbarPlusCCbar CMS_ttHbb_HDAMP_ttbarOther" << std::endl;
-      datacard_<< "btag group = CMS_btag_lf CMS_btag_hf CMS_btag_hfstats1 CMS_btag_hfstats2 CMS_btag_cferr1 CMS_btag_cferr2 CMS_btag_lfstats1 CMS_btag_lfstats2" << std::endl;
-      datacard_<< "bgnorm group = bgnorm_ttbarPlus2B bgnorm_ttbarPlusB bgnorm_ttbarPlusBBbar bgnorm_ttbarPlusCCbar" << std::endl;
-      datacard_<< "pdf group = pdf_gg  pdf_qg pdf_qqbar pdf_Higgs_ttH" << std::endl;
-      datacard_<< "QCDscale group = QCDscale_V QCDscale_VV QCDscale_singlet QCDscale_ttH QCDscale_ttbar" << std::endl;
-      datacard_<< "misc group = CMS_ttHbb_UE_ttbarPlusBBbar CMS_ttHbb_UE_ttbarPlus2B CMS_ttHbb_UE_ttbarPlusB CMS_ttHbb_UE_ttbarPlusCCbar CMS_ttHbb_UE_ttbarOther CMS_ttHbb_ISR_ttbarPlusBBbar CMS_ttHbb_ISR_ttbarPlus2B CMS_ttHbb_ISR_ttbarPlusB CMS_ttHbb_ISR_ttbarPlusCCbar CMS_ttHbb_ISR_ttbarOther CMS_ttHbb_FSR_ttbarPlusBBbar CMS_ttHbb_FSR_ttbarPlus2B CMS_ttHbb_FSR_ttbarPlusB CMS_ttHbb_FSR_ttbarPlusCCbar CMS_ttHbb_FSR_ttbarOther CMS_ttHbb_HDAMP_ttbarPlusBBbar CMS_ttHbb_HDAMP_ttbarPlus2B CMS_ttHbb_HDAMP_ttbarPlusB CMS_ttHbb_HDAMP_ttbarPlusCCbar CMS_ttHbb_HDAMP_ttbarOther" << std::endl;
-    }
+  // Record the inputs of the written outputs for the next incremental run
+  for(auto& job : jobs) {
+    if(job->inputHashes) job->inputHashes->set(job->directory, "#configuration", configurationHash, DatacardInputHashes::fileHash(job->datacardName));
+  }
+  for(auto& inputHashes : inputHashes_) inputHashes.second->save();
+  inputHashes_.clear();
+
+  // Keep the resolved inputs for the next run
+  manifest_.save(manifestFileName_);
 
-    std::cout << "Closing file: " << datacardName_ << std::endl;
-    datacard_.close();
+  if(!snapshotOutputFile_.empty()) {
+    std::cout << "Writing histogram snapshot: " << snapshotOutputFile_ << std::endl;
+    histogramCache_.exportSnapshot(snapshotOutputFile_);
   }
 
+  histogramCache_.setSnapshot(0);
+  snapshot_.reset();
 }
 
 
-void DatacardMaker::writeHeader(const std::string& name)
+void DatacardMaker::writeDatacard(DatacardJob& job)
 {
-  TObjArray* token  = TString(name).Tokenize("_");
-  TString filename  = TString(name);
-  TString eventCategory  = ((TObjString*)token->At(token->GetLast()))->GetString();
+  DatacardProfiler::Scope profile("writeDatacard");
 
-  if(!datacard_.is_open())
-    datacard_.open(datacardName_, std::ios::out);
+  const Channel::Channel channel = job.channel;
 
-  datacard_ << "imax\t*\tnumber of categories" << std::endl;
-  datacard_ << "jmax\t*\tnumber of samples minus one" << std::endl;
-  datacard_ << "kmax\t*\tnumber of nuisance parameter" << std::endl;
-  datacard_ << "----------------------------------------------------------------------------------------------------------------------" << std::endl;
-  datacard_ << "\nshapes * * " << "common/ttH_hbb_13TeV_dl.root" << "\t$CHANNEL_"+observableType_+"/$PROCESS\t$CHANNEL_"+observableType_+"/$PROCESS_$SYSTEMATIC" << std::endl;
-  //datacard_ << "\nshapes ttH$MASS_hbb * " << "ttH_hbb_13TeV_dl.root" << "\t$CHANNEL_"+observableType_+"/$PROCESS$MASS\t$CHANNEL_"+observableType_+"/$PROCESS$MASS_$SYSTEMATIC" << std::endl;
-  datacard_ << "----------------------------------------------------------------------------------------------------------------------" << std::endl;
+  for(Systematic::Systematic systematic : v_systematic_) {   
+      
+    const SystematicClassification& systematicClassification = classification(systematic.type());
 
-  datacard_.close();
-}
+    // Check if systematic type is lnN (i.e. rate) if so skip
+    if(systematicClassification.kind == lnN) continue;
 
+    // Input root file of the datacard, looked up in the file lists indexed before production
+    const std::string fileName(job.name+"_source.root");
+    const std::string& fileNameWithDirPath = fileListIndex_.find(channel, systematic, fileName);
 
-void DatacardMaker::writeSystematicUncertainties() 
-{ 
-  if(!datacard_.is_open())
-    datacard_.open(datacardName_, std::ios::out | std::ios::app);
+    if(fileNameWithDirPath.empty()) {
+      std::cout << "\n\tWe didn't find the " << fileName << " input in file list: " << inputFileListName(channel, systematic) << std::endl;
+      continue;
+    }
 
-  // Write out the sources of systematic/statistical uncertainty and their values to the datacard file 
-  for(Systematic::Systematic systematic : v_systematic_) {
+    job.inputFileLists[channel][systematic][fileName] = fileNameWithDirPath;
+  }
+   
+  readYields(job);
+
+  // Datacard text and statistical uncertainties depend only on the nominal input, if unchanged only the changed shapes are written
+  // A changed nominal input changes which statistical uncertainty templates survive, so the datacard is rebuilt with all inputs
+  if(!job.rebuild) {
+    bool nominalChanged(false);
+    for(const auto& systematicHistograms : job.yields) {
+      if(systematicHistograms.first.type() == Systematic::nominal) nominalChanged = true;
+    }
 
-    // Constructing a neutral systematic for which two variations will be stored         
-    Systematic::Systematic systematicToStore = Systematic::Systematic(systematic.type(), Systematic::undefinedVariation, systematic.variationNumber());
+    if(!nominalChanged) {
+      std::cout << "\nUnchanged datacard: " << job.datacardName << " (" << job.yields.size() << " changed inputs)" << std::endl;
+      writeYields(job);
+      job.yields.clear();
+      return;
+    }
 
-    std::string nameOfSystematic = systematicToStore.name().Data();
-    std::string tmp0 = convertSystematicLabel_[nameOfSystematic+"_UP"];
-    std::string tmp1;
+    job.rebuild = true;
+    job.yields.clear();
+    readYields(job);
+  }
 
-    if(!tmp0.empty())
-      tmp1 = tmp0.substr(0,tmp0.size()-2);
-    //std::string tmp = TString(convertSystematicLabel_[nameOfSystematic+"_UP"]).ReplaceAll("Up","").Data();
-    std::string tmp = tmp1;
-    const char* systematType = tmp.c_str();    
+  // Rebuilt datacard in an updated output root file: outputs not produced anymore must not survive from previous runs
+  if(incremental_ && !recreatedOutputFiles_.count(job.outputDir+outputFileName_)) this->clearOutputDirectory(job);
 
-    std::string shape("shape");
-    std::string lnN("lnN");
+  TString labelString;
+  TObjString labels;
 
-    if(systematic.variation() == Systematic::down) continue;
+  // Fill maps and meta information
+  for(auto convertedSysLabel : convertSystematicLabel_) {
+    labelString  += TString::Format("%s\t%s\n", (convertedSysLabel.first).c_str(), (convertedSysLabel.second).c_str());
+  }
 
-    // Select if systematic uncertainty is of type shape and lnN
-    if(std::find_if(listOfSystematicsByType_.begin(),listOfSystematicsByType_.end(),compare(nameOfSystematic,shape)) != listOfSystematicsByType_.end()) {
-
-      if(systematic.type() == Systematic::btagDiscrBstat1     || systematic.type() == Systematic::btagDiscrBstat2 
-         || systematic.type() == Systematic::btagDiscrLstat1  || systematic.type() == Systematic::btagDiscrLstat2
-         || systematic.type() == Systematic::btagDiscrBpurity || systematic.type() == Systematic::btagDiscrLpurity
-         || systematic.type() == Systematic::btagDiscrCerr1   || systematic.type() == Systematic::btagDiscrCerr2
-         || systematic.type() == Systematic::jes || systematic.type() == Systematic::jer 
-         || systematic.type() == Systematic::jesAbsoluteStat
-         || systematic.type() == Systematic::jesAbsoluteScale
-         || systematic.type() == Systematic::jesAbsoluteFlavMap
-         || systematic.type() == Systematic::jesAbsoluteMPFBias
-         || systematic.type() == Systematic::jesFragmentation
-         || systematic.type() == Systematic::jesSinglePionECAL
-         || systematic.type() == Systematic::jesSinglePionHCAL
-         || systematic.type() == Systematic::jesFlavorQCD
-         || systematic.type() == Systematic::jesTimePtEta
-         //|| systematic.type() == Systematic::jesTimePt
-         || systematic.type() == Systematic::jesRelativeJEREC1
-         || systematic.type() == Systematic::jesRelativeJEREC2
-         || systematic.type() == Systematic::jesRelativeJERHF
-         || systematic.type() == Systematic::jesRelativePtBB
-         || systematic.type() == Systematic::jesRelativePtEC1
-         || systematic.type() == Systematic::jesRelativePtEC2
-         || systematic.type() == Systematic::jesRelativePtHF
-         || systematic.type() == Systematic::jesRelativeFSR
-         || systematic.type() == Systematic::jesRelativeBal
-         || systematic.type() == Systematic::jesRelativeStatFSR
-         || systematic.type() == Systematic::jesRelativeStatEC
-         || systematic.type() == Systematic::jesRelativeStatHF
-         || systematic.type() == Systematic::jesPileUpDataMC
-         || systematic.type() == Systematic::jesPileUpPtRef
-         || systematic.type() == Systematic::jesPileUpPtBB
-         || systematic.type() == Systematic::jesPileUpPtEC1
-         || systematic.type() == Systematic::jesPileUpPtEC2
-         || systematic.type() == Systematic::jesPileUpPtHF
-         || systematic.type() == Systematic::jesPileUpMuZero
-         || systematic.type() == Systematic::jesPileUpEnvelope
-         || systematic.type() == Systematic::jesSubTotalPileUp
-         || systematic.type() == Systematic::jesSubTotalRelative
-         || systematic.type() == Systematic::jesSubTotalPt
-         || systematic.type() == Systematic::jesSubTotalScale
-         || systematic.type() == Systematic::jesSubTotalMC
-         || systematic.type() == Systematic::jesSubTotalAbsolute
-         || systematic.type() == Systematic::jesTotalNoFlavor
-         || systematic.type() == Systematic::jesFlavorZJet
-         || systematic.type() == Systematic::jesFlavorPhotonJet
-         || systematic.type() == Systematic::jesFlavorPureGluon
-         || systematic.type() == Systematic::jesFlavorPureQuark
-         || systematic.type() == Systematic::jesFlavorPureCharm
-         || systematic.type() == Systematic::jesFlavorPureBottom
-         || systematic.type() == Systematic::jesCorrelationGroupMPFInSitu
-         || systematic.type() == Systematic::jesCorrelationGroupIntercalibration
-         || systematic.type() == Systematic::jesCorrelationGroupbJES
-         || systematic.type() == Systematic::jesCorrelationGroupFlavor
-         || systematic.type() == Systematic::jesCorrelationGroupUncorrelated
-         || systematic.type() == Systematic::pdf
-         || systematic.type() == Systematic::scale_ttb    || systematic.type() == Systematic::scale_ttbb      || systematic.type() == Systematic::scale_tt2b
-         || systematic.type() == Systematic::scale_ttcc   || systematic.type() == Systematic::scale_ttother   || systematic.type() == Systematic::scale
-         || systematic.type() == Systematic::meScale_ttb  || systematic.type() == Systematic::meScale_ttbb    || systematic.type() == Systematic::meScale_tt2b
-         || systematic.type() == Systematic::meScale_ttcc || systematic.type() == Systematic::meScale_ttother || systematic.type() == Systematic::meScale 
-         || systematic.type() == Systematic::psScale_ttb  || systematic.type() == Systematic::psScale_ttbb    || systematic.type() == Systematic::psScale_tt2b
-         || systematic.type() == Systematic::psScale_ttcc || systematic.type() == Systematic::psScale_ttother || systematic.type() == Systematic::psScale
-         || systematic.type() == Systematic::pu || systematic.type() == Systematic::trig || systematic.type() == Systematic::lept
-         || systematic.type() == Systematic::meFacScale || systematic.type() == Systematic::meRenScale 
-         || systematic.type() == Systematic::psFSRScale
-         || systematic.type() == Systematic::psFSRScale_ttbb || systematic.type() == Systematic::psFSRScale_ttb || systematic.type() == Systematic::psFSRScale_tt2b || systematic.type() == Systematic::psFSRScale_ttcc || systematic.type() == Systematic::psFSRScale_ttother
-         || systematic.type() == Systematic::psISRScale || systematic.type() == Systematic::ueTune || systematic.type() == Systematic::match
-         ) {
-        datacard_ << TString::Format("%-32s shape\t\t", systematType);
-
-        for (auto p : processNames_) {
-
-          if((p == "data") || (p == "allmc")) continue;
-
-          // Uncertainty value for all processess or selected processes
-          if(std::find_if(valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].begin(), valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].end(),comp("all")) != valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].end()) {
-            std::string value = valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].at(0).second;
-
-            datacard_ << TString::Format("%-8.11s\t", value.c_str());            
-          }
-          else if(std::find_if(valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].begin(), valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].end(), comp(p)) != valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].end()) {
+  std::cout << "\nOpening file: " << job.datacardName << std::endl;
 
-            auto iter = std::find_if(valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].begin(), valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].end(), comp(p));
-            auto index = std::distance(valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].begin(), iter);
-            std::string value = valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].at(index).second;
+  // Fill meta information on what mapping labeling used into the event category directory
+  labels = labelString.Data();
+  this->store(job, labels, "MetaInfoLabelConvert");
 
-            datacard_ << TString::Format("%-8.11s\t", value.c_str()); 
-          }
-          else {                                                                                                                          
-            datacard_ << TString::Format("%-8.11s\t", "-");
-          }
-        }
-        datacard_ << std::endl;
-      }
+  // Start writing datacard
+  writeHeader(job);
+  extractYields(job);
+
+  job.datacard.section(DatacardBuilder::systematics) << "#Source of uncertainty\t\t pdf\t\t";
+
+  for(auto process : processNames_) {
+    if(process != "allmc" && process != "data") {
+      job.datacard.column(convertLabel(convertSampleNames_, process), 8) << "\t";
     }
-    else if(std::find_if(listOfSystematicsByType_.begin(),listOfSystematicsByType_.end(),compare(nameOfSystematic,lnN)) != listOfSystematicsByType_.end()) {
-
-      if(systematic.type() == Systematic::xsec_ttb || systematic.type() == Systematic::xsec_ttbb || systematic.type() == Systematic::xsec_tt2b
-         || systematic.type() == Systematic::xsec_ttcc || systematic.type() == Systematic::xsec_ttother
-         || systematic.type() == Systematic::psFSRScale 
-         || systematic.type() == Systematic::psFSRScale_ttbb
-         || systematic.type() == Systematic::psFSRScale_tt2b
-         || systematic.type() == Systematic::psFSRScale_ttb
-         || systematic.type() == Systematic::psFSRScale_ttcc
-         || systematic.type() == Systematic::psFSRScale_ttother
-         || systematic.type() == Systematic::psISRScale 
-         || systematic.type() == Systematic::psISRScale_ttbb
-         || systematic.type() == Systematic::psISRScale_tt2b
-         || systematic.type() == Systematic::psISRScale_ttb
-         || systematic.type() == Systematic::psISRScale_ttcc
-         || systematic.type() == Systematic::psISRScale_ttother
-         || systematic.type() == Systematic::ueTune
-         || systematic.type() == Systematic::ueTune_ttbb
-         || systematic.type() == Systematic::ueTune_tt2b
-         || systematic.type() == Systematic::ueTune_ttb
-         || systematic.type() == Systematic::ueTune_ttcc
-         || systematic.type() == Systematic::ueTune_ttother
-         || systematic.type() == Systematic::match
-         || systematic.type() == Systematic::match_ttbb
-         || systematic.type() == Systematic::match_tt2b
-         || systematic.type() == Systematic::match_ttb
-         || systematic.type() == Systematic::match_ttcc
-         || systematic.type() == Systematic::match_ttother
-         ) {
-        datacard_ << TString::Format("%-32s lnN\t\t", systematType); 
-        
-        for (auto p : processNames_) {
+  }
+  job.datacard << std::endl;
+
+  writeYields(job);
+  if(addSystematicUncertainty_) writeSystematicUncertainties(job);
+  if(addStatisticalUncertainty_) writeStatisticalUncertainties(job);
+
+  bool append_to_datacard_systematic_group_labels(false);
+
+  if(append_to_datacard_systematic_group_labels) {
+
+    job.datacard.section(DatacardBuilder::groups) << "\n"<< std::endl;
+    job.datacard << "exp group = lumi_13TeV_2016 CMS_res_j CMS_ttHbb_effTrigger_dl CMS_scaleAbsoluteMPFBias_j CMS_scaleAbsoluteScale_j CMS_scaleAbsoluteStat_j CMS_scaleFlavorQCD_j CMS_scaleFragmentation_j CMS_scalePileUpDataMC_j CMS_scalePileUpPtBB_j CMS_scalePileUpPtEC1_j CMS_scalePileUpPtEC2_j CMS_scalePileUpPtHF_j CMS_scalePileUpPtRef_j CMS_scaleRelativeBal_j CMS_scaleRelativeFSR_j CMS_scaleRelativeJEREC1_j CMS_scaleRelativeJEREC2_j CMS_scaleRelativeJERHF_j CMS_scaleRelativePtBB_j CMS_scaleRelativePtEC1_j CMS_scaleRelativePtEC2_j CMS_scaleRelativePtHF_j CMS_scaleRelativeStatEC_j CMS_scaleRelativeStatFSR_j CMS_scaleRelativeStatHF_j CMS_scaleSinglePionECAL_j CMS_scaleSinglePionHCAL_j CMS_scaleTimePtEta_j CMS_btag_lf CMS_btag_hf CMS_btag_hfstats1 CMS_btag_hfstats2 CMS_btag_cferr1 CMS_btag_cferr2 CMS_btag_lfstats1 CMS_btag_lfstats2 CMS_ttHbb_PU" << std::endl;
+    job.datacard << "syst group = QCDscale_V QCDscale_VV QCDscale_singlet QCDscale_ttH QCDscale_ttbar bgnorm_ttbarPlus2B bgnorm_ttbarPlusB bgnorm_ttbarPlusBBbar bgnorm_ttbarPlusCCbar pdf_gg pdf_qg pdf_qqbar pdf_Higgs_ttH lumi_13TeV_2016 CMS_res_j CMS_scaleAbsoluteMPFBias_j CMS_scaleAbsoluteScale_j CMS_scaleAbsoluteStat_j CMS_scaleFlavorQCD_j CMS_scaleFragmentation_j CMS_scalePileUpDataMC_j CMS_scalePileUpPtBB_j CMS_scalePileUpPtEC1_j CMS_scalePileUpPtEC2_j CMS_scalePileUpPtHF_j CMS_scalePileUpPtRef_j CMS_scaleRelativeBal_j CMS_scaleRelativeFSR_j CMS_scaleRelativeJEREC1_j CMS_scaleRelativeJEREC2_j CMS_scaleRelativeJERHF_j CMS_scaleRelativePtBB_j CMS_scaleRelativePtEC1_j CMS_scaleRelativePtEC2_j CMS_scaleRelativePtHF_j CMS_scaleRelativeStatEC_j CMS_scaleRelativeStatFSR_j CMS_scaleRelativeStatHF_j CMS_scaleSinglePionECAL_j CMS_scaleSinglePionHCAL_j CMS_scaleTimePtEta_j CMS_btag_lf CMS_btag_hf CMS_btag_hfstats1 CMS_btag_hfstats2 CMS_btag_cferr1 CMS_btag_cferr2 CMS_btag_lfstats1 CMS_btag_lfstats2 CMS_ttHbb_PU CMS_ttHbb_PDF CMS_ttHbb_scaleMuF CMS_ttHbb_scaleMuR CMS_ttHbb_UE_ttbarPlusBBbar CMS_ttHbb_UE_ttbarPlus2B CMS_ttHbb_UE_ttbarPlusB CMS_ttHbb_UE_ttbarPlusCCbar CMS_ttHbb_UE_ttbarOther CMS_ttHbb_ISR_ttbarPlusBBbar CMS_ttHbb_ISR_ttbarPlus2B CMS_ttHbb_ISR_ttbarPlusB CMS_ttHbb_ISR_ttbarPlusCCbar CMS_ttHbb_ISR_ttbarOther CMS_ttHbb_FSR_ttbarPlusBBbar CMS_ttHbb_FSR_ttbarPlus2B CMS_ttHbb_FSR_ttbarPlusB CMS_ttHbb_FSR_ttbarPlusCCbar CMS_ttHbb_FSR_ttbarOther CMS_ttHbb_HDAMP_ttbarPlusBBbar CMS_ttHbb_HDAMP_ttbarPlus2B CMS_ttHbb_HDAMP_ttbarPlusB CMS_ttHbb_HDAMP_ttbarPlusCCbar CMS_ttHbb_HDAMP_ttbarOther" << std::endl;
+    job.datacard << "jes group = CMS_scaleAbsoluteMPFBias_j CMS_scaleAbsoluteScale_j CMS_scaleAbsoluteStat_j CMS_scaleFlavorQCD_j CMS_scaleFragmentation_j CMS_scalePileUpDataMC_j CMS_scalePileUpPtBB_j CMS_scalePileUpPtEC1_j CMS_scalePileUpPtEC2_j CMS_scalePileUpPtHF_j CMS_scalePileUpPtRef_j CMS_scaleRelativeBal_j CMS_scaleRelativeFSR_j CMS_scaleRelativeJEREC1_j CMS_scaleRelativeJEREC2_j CMS_scaleRelativeJERHF_j CMS_scaleRelativePtBB_j CMS_scaleRelativePtEC1_j CMS_scaleRelativePtEC2_j CMS_scaleRelativePtHF_j CMS_scaleRelativeStatEC_j CMS_scaleRelativeStatFSR_j CMS_scaleRelativeStatHF_j CMS_scaleSinglePionECAL_j CMS_scaleSinglePionHCAL_j CMS_scaleTimePtEta_j" << std::endl;
+    job.datacard<< "theory group = QCDscale_V QCDscale_VV QCDscale_singlet QCDscale_ttH QCDscale_ttbar bgnorm_ttbarPlus2B bgnorm_ttbarPlusB bgnorm_ttbarPlusBBbar bgnorm_ttbarPlusCCbar pdf_gg pdf_qg pdf_qqbar pdf_Higgs_ttH CMS_ttHbb_PDF CMS_ttHbb_scaleMuF CMS_ttHbb_scaleMuR CMS_ttHbb_UE_ttbarPlusBBbar CMS_ttHbb_UE_ttbarPlus2B CMS_ttHbb_UE_ttbarPlusB CMS_ttHbb_UE_ttbarPlusCCbar CMS_ttHbb_UE_ttbarOther CMS_ttHbb_ISR_ttbarPlusBBbar CMS_ttHbb_ISR_ttbarPlus2B CMS_ttHbb_ISR_ttbarPlusB CMS_ttHbb_ISR_ttbarPlusCCbar CMS_ttHbb_ISR_ttbarOther CMS_ttHbb_FSR_ttbarPlusBBbar CMS_ttHbb_FSR_ttbarPlus2B CMS_ttHbb_FSR_ttbarPlusB CMS_ttHbb_FSR_ttbarPlusCCbar CMS_ttHbb_FSR_ttbarOther CMS_ttHbb_HDAMP_ttbarPlusBBbar CMS_ttHbb_HDAMP_ttbarPlus2B CMS_ttHbb_HDAMP_ttbarPlusB CMS_ttHbb_HDAMP_ttbarPlusCCbar CMS_ttHbb_HDAMP_ttbarOther" << std::endl;
+    job.datacard<< "btag group = CMS_btag_lf CMS_btag_hf CMS_btag_hfstats1 CMS_btag_hfstats2 CMS_btag_cferr1 CMS_btag_cferr2 CMS_btag_lfstats1 CMS_btag_lfstats2" << std::endl;
+    job.datacard<< "bgnorm group = bgnorm_ttbarPlus2B bgnorm_ttbarPlusB bgnorm_ttbarPlusBBbar bgnorm_ttbarPlusCCbar" << std::endl;
+    job.datacard<< "pdf group = pdf_gg  pdf_qg pdf_qqbar pdf_Higgs_ttH" << std::endl;
+    job.datacard<< "QCDscale group = QCDscale_V QCDscale_VV QCDscale_singlet QCDscale_ttH QCDscale_ttbar" << std::endl;
+    job.datacard<< "misc group = CMS_ttHbb_UE_ttbarPlusBBbar CMS_ttHbb_UE_ttbarPlus2B CMS_ttHbb_UE_ttbarPlusB CMS_ttHbb_UE_ttbarPlusCCbar CMS_ttHbb_UE_ttbarOther CMS_ttHbb_ISR_ttbarPlusBBbar CMS_ttHbb_ISR_ttbarPlus2B CMS_ttHbb_ISR_ttbarPlusB CMS_ttHbb_ISR_ttbarPlusCCbar CMS_ttHbb_ISR_ttbarOther CMS_ttHbb_FSR_ttbarPlusBBbar CMS_ttHbb_FSR_ttbarPlus2B CMS_ttHbb_FSR_ttbarPlusB CMS_ttHbb_FSR_ttbarPlusCCbar CMS_ttHbb_FSR_ttbarOther CMS_ttHbb_HDAMP_ttbarPlusBBbar CMS_ttHbb_HDAMP_ttbarPlus2B CMS_ttHbb_HDAMP_ttbarPlusB CMS_ttHbb_HDAMP_ttbarPlusCCbar CMS_ttHbb_HDAMP_ttbarOther" << std::endl;
+  }
 
-          if((p == "data") || (p == "allmc")) continue;
+  // Write the complete datacard in one go
+  std::cout << "Closing file: " << job.datacardName << std::endl;
+  job.datacard.write(job.datacardName);
+  job.datacard.clear();
+  job.yields.clear();
+}
 
-          // Cross section systematic uncertainties apply to only selective processes
-          auto iter = std::find_if(valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].begin(), valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].end(), comp(p));
 
-          if(iter != valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].end()) {
+void DatacardMaker::writeHeader(DatacardJob& job)
+{
+  const std::string& name = job.name;
 
-            auto index = std::distance(valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].begin(), iter);
-            std::string value = valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].at(index).second;
+  TObjArray* token  = TString(name).Tokenize("_");
+  TString filename  = TString(name);
+  TString eventCategory  = ((TObjString*)token->At(token->GetLast()))->GetString();
 
-            datacard_ << TString::Format("%-8.11s\t", value.c_str());
-          }
-          else datacard_ << TString::Format("%-8.11s\t", "-");
-        }
-        datacard_ << std::endl;
-      } 
-      else if (systematic.type() == Systematic::lumi || systematic.type() == Systematic::trig || systematic.type() ==  Systematic::xsec_ttH
-               || systematic.type() == Systematic::normPdfGg  || systematic.type() == Systematic::normPdfGq || systematic.type() == Systematic::normPdfQq
-               || systematic.type() == Systematic::normPdfTth || systematic.type() == Systematic::xsec_tt   || systematic.type() == Systematic::xsec_t
-               || systematic.type() == Systematic::xsec_v || systematic.type() == Systematic::xsec_vv
-               || systematic.type() == Systematic::xsec_ttZ || systematic.type() == Systematic::xsec_ttW || systematic.type() == Systematic::xsec_ttG
-               //|| systematic.type() == Systematic::lept
-               ) {
-        datacard_ << TString::Format("%-32s lnN\t\t", systematType);
+  job.datacard.section(DatacardBuilder::header) << "imax\t*\tnumber of categories" << std::endl;
+  job.datacard << "jmax\t*\tnumber of samples minus one" << std::endl;
+  job.datacard << "kmax\t*\tnumber of nuisance parameter" << std::endl;
+  job.datacard << "----------------------------------------------------------------------------------------------------------------------" << std::endl;
+  job.datacard << "\nshapes * * " << "common/ttH_hbb_13TeV_dl.root" << "\t$CHANNEL_"+observableType_+"/$PROCESS\t$CHANNEL_"+observableType_+"/$PROCESS_$SYSTEMATIC" << std::endl;
+  //job.datacard << "\nshapes ttH$MASS_hbb * " << "ttH_hbb_13TeV_dl.root" << "\t$CHANNEL_"+observableType_+"/$PROCESS$MASS\t$CHANNEL_"+observableType_+"/$PROCESS$MASS_$SYSTEMATIC" << std::endl;
+  job.datacard << "----------------------------------------------------------------------------------------------------------------------" << std::endl;
+}
 
-        for (auto p : processNames_) {
 
-          if((p == "data") || (p == "allmc")) continue;
+void DatacardMaker::initializeSystematicMatrix()
+{
+  systematicRows_.clear();
+  systematicCells_.clear();
 
-          // Uncertainty value for all processess or selected processes
-          if(std::find_if(valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].begin(), valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].end(),comp("all")) != valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].end()) {
+  systematicColumns_ = std::count_if(processNames_.begin(), processNames_.end(), [](const std::string& p) {return (p != "data") && (p != "allmc");});
 
-            auto iter = std::find_if(valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].begin(), valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].end(), comp("all"));
-            auto index = std::distance(valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].begin(), iter);
-            std::string value = valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].at(index).second;
+  for(Systematic::Systematic systematic : v_systematic_) {
 
-            datacard_ << TString::Format("%-8.11s\t", value.c_str());
-          }
-          else if(std::find_if(valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].begin(), valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].end(), comp(p)) != valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].end()) {
+    if(systematic.variation() == Systematic::down) continue;
 
-            auto iter = std::find_if(valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].begin(), valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].end(), comp(p));
-            auto index = std::distance(valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].begin(), iter);
-            std::string value = valueOfSystematicBasedOnProcess_[systematicToStore.name().Data()].at(index).second;
+    // Select if systematic uncertainty is of type shape and lnN
+    const SystematicClassification& systematicClassification = classification(systematic.type());
+    if(systematicClassification.kind == skip) continue;
 
-            datacard_ << TString::Format("%-8.11s\t", value.c_str());               
-          }
-          else datacard_ << TString::Format("%-8.11s\t", "-");
-        }
-        datacard_ << std::endl;
+    if(systematicClassification.kind == shape)
+      systematicRows_.push_back(TString::Format("%-32s shape\t\t", systematicClassification.label.c_str()).Data());
+    else
+      systematicRows_.push_back(TString::Format("%-32s lnN\t\t", systematicClassification.label.c_str()).Data());
+
+    for (auto p : processNames_) {
+
+      if((p == "data") || (p == "allmc")) continue;
+
+      // Uncertainty value for all processess or selected processes
+      std::string value("-");
+
+      if(systematicClassification.values) {
+        const std::vector<std::pair<std::string, std::string> >& values = *systematicClassification.values;
+
+        auto iter = std::find_if(values.begin(), values.end(), comp("all"));
+        if(iter == values.end()) iter = std::find_if(values.begin(), values.end(), comp(p));
+        if(iter != values.end()) value = iter->second;
       }
-    }    
+
+      systematicCells_.push_back(TString::Format("%-8.11s\t", value.c_str()).Data());
+    }
   }
-  datacard_.close();
 }
 
 
-void DatacardMaker::writeStatisticalUncertainties(const std::string& name)
+void DatacardMaker::writeSystematicUncertainties(DatacardJob& job)
 {
-  // Force all histograms to use option Sumw2(), to switch histogram errors
-  TH1::SetDefaultSumw2();
-
-  TObjArray* token  = TString(name).Tokenize("_");
-  TString filename  = TString(name);
-  TString eventCategory  = ((TObjString*)token->At(token->GetLast()))->GetString();
+  DatacardProfiler::Scope profile("writeSystematicUncertainties");
 
-  if(!datacard_.is_open())
-    datacard_.open(datacardName_, std::ios::out | std::ios::app);
+  job.datacard.section(DatacardBuilder::systematics);
 
-  std::map<TString,TH1*> mapOfNominalHisto;
-  std::map<TString, int> shiftUpDown;
+  // Write out the sources of systematic uncertainty and their values to the datacard file, row by row
+  for(size_t iRow = 0; iRow < systematicRows_.size(); ++iRow) {
 
-  shiftUpDown["Down"] = -1.0;
-  shiftUpDown["Up"] = 1.0;
+    job.datacard << systematicRows_[iRow];
 
-  for(auto channelCollection = inputFileLists_->begin(); channelCollection != inputFileLists_->end(); ++channelCollection) {
+    for(size_t iColumn = 0; iColumn < systematicColumns_; ++iColumn) {
+      job.datacard << systematicCells_[iRow*systematicColumns_ + iColumn];
+    }
+    job.datacard << std::endl;
+  }
+}
 
-    double data_bin_error(-999.);
 
-    double sig_bin_content(-999.);
-    //double sig_bin_error(-999.);
-    double bkg_bin_content(-999.);
-    double bkg_bin_error(-999.);
-    double sample_bin_content(-999.);
-    double sample_bin_error(-999.);
-    double other_frac(-999.);
+void DatacardMaker::writeStatisticalUncertainties(DatacardJob& job)
+{
+  DatacardProfiler::Scope profile("writeStatisticalUncertainties");
 
-    TH1* sig_hist(NULL);
-    TH1* bkg_hist(NULL);
-    TH1* data_hist(NULL);
+  const std::string& name = job.name;
 
-    std::string obsProcess;
+  TString filename  = TString(name);
 
-    for(TString processName : processNames_) {
+  job.datacard.section(DatacardBuilder::statistics);
 
-      if (processName.Contains("data") || processName.Contains("allmc")) {
+  std::map<TString, int> shiftUpDown;
 
-        obsProcess = processName;
-        continue;
-      }
+  shiftUpDown["Down"] = -1.0;
+  shiftUpDown["Up"] = 1.0;
 
-      for(auto systematicCollection : (*channelCollection).second) {
+  for(auto channelCollection = job.inputFileLists.begin(); channelCollection != job.inputFileLists.end(); ++channelCollection) {
 
-        TString nominalFile;
+    // Find nominal input file of the event category
+    const Systematic::Systematic* nominal(NULL);
+    TString nominalFile;
 
-        for(auto nameOfFile : systematicCollection.second) {
-          nominalFile = TString(nameOfFile.second);
-        }
+    for(const auto& systematicCollection : (*channelCollection).second) {
 
-        Systematic::Systematic systematic = systematicCollection.first;
+      if(systematicCollection.first.type() != Systematic::nominal) continue;
 
-        if(systematic.type() == Systematic::nominal) {
+      auto nameOfFile = systematicCollection.second.find(name+"_source.root");
+      if(nameOfFile != systematicCollection.second.end()) {
+        nominal = &systematicCollection.first;
+        nominalFile = TString(nameOfFile->second);
+      }
+    }
 
-          data_hist =  addOrCreateHisto(data_hist, static_cast<TH1*>((TH1F*)fileReader_->GetClone<TH1>(nominalFile, TString(name)+"_"+TString(obsProcess), true, false)->Clone()));
+    if(!nominal) {
+      std::cout<<"\n\tWe didn't find the "+TString(filename+"_source.root")+" nominal input!!\n";
+      continue;
+    }
 
-          for (auto pro : processNames_) {
+    // Aggregate mode: a single directive lets the fit build one MC stat. nuisance per bin from the process templates,
+    // so neither the summed templates nor any histogram are needed here
+    if(statisticalUncertaintyMode_ == autoMCStats) {
+      job.datacard.column(job.category, 32) << TString::Format(" autoMCStats\t%g\t%d\t%d", autoMCStatsThreshold_, 0, 1) << std::endl;
+      continue;
+    }
 
-            if(TString(pro).Contains(signalModel_))
-              sig_hist = addOrCreateHisto(sig_hist, static_cast<TH1*>(fileReader_->GetClone<TH1>(nominalFile, name+"_"+TString(pro), true, false)));
-            
-            if((pro == "data") || (pro == "allmc") || (pro == "signamlc") || TString(pro).Contains(signalModel_)) continue;
+    // Observed process, the last of data or pseudo-data in the list of processes
+    std::string obsProcess;
+    for(TString processName : processNames_) {
+      if (processName.Contains("data") || processName.Contains("allmc")) obsProcess = processName;
+    }
 
-            bkg_hist = addOrCreateHisto(bkg_hist, (TH1*)fileReader_->GetClone<TH1>(nominalFile, TString(name)+"_"+TString(pro), true, false));
-          }
+    // Sum of signal, background and data histograms, built once per event category
+    HistogramAccumulator sig_hist;
+    HistogramAccumulator bkg_hist;
+    HistogramAccumulator data_hist;
 
-          TH1* sample_hist(NULL);
-          sample_hist = addOrCreateHisto(sample_hist, static_cast<TH1*>(fileReader_->GetClone<TH1>(nominalFile, name+"_"+processName, true, false)));
+    this->accumulate(data_hist, nominalFile, TString(name)+"_"+TString(obsProcess), *nominal);
 
-          int numBins = sample_hist->GetNbinsX();
+    for (auto pro : processNames_) {
 
-          for(auto shift : shiftUpDown){
+      HistogramAccumulator pro_hist;
+      if(!this->accumulate(pro_hist, nominalFile, TString(name)+"_"+TString(pro), *nominal)) continue;
 
-            // Set protection against down shift to zero for bin content
-            if(shift.second < 0 && sample_hist->Integral() == 0.) 
-              addOrCreateHisto(static_cast<TH1*>(mapOfNominalHisto[processName]), sample_hist);
-            else
-              mapOfNominalHisto[processName] = (TH1D*)sample_hist->Clone();
+      if(TString(pro).Contains(signalModel_))
+        sig_hist += pro_hist;
 
-            for (int iBin = 0; iBin < numBins; ++iBin) {
+      if((pro == "data") || (pro == "allmc") || (pro == "signamlc") || TString(pro).Contains(signalModel_)) continue;
 
-              data_bin_error = data_hist->GetBinError(iBin+1);
+      bkg_hist += pro_hist;
+    }
 
-              sig_bin_content = sig_hist->GetBinContent(iBin+1);
-              //sig_bin_error   = sig_hist->GetBinError(iBin+1);
+    std::vector<double> data_bin_content, data_bin_error;
+    std::vector<double> sig_bin_content, sig_bin_error;
+    std::vector<double> bkg_bin_content, bkg_bin_error;
 
-              bkg_bin_content = bkg_hist->GetBinContent(iBin+1);
-              bkg_bin_error   = bkg_hist->GetBinError(iBin+1);
+    data_hist.binContents(data_bin_content, data_bin_error);
+    sig_hist.binContents(sig_bin_content, sig_bin_error);
+    bkg_hist.binContents(bkg_bin_content, bkg_bin_error);
 
-              sample_bin_content = mapOfNominalHisto[processName]->GetBinContent(iBin+1);
-              sample_bin_error   = mapOfNominalHisto[processName]->GetBinError(iBin+1);
+    BinByBinStatEngine engine(data_bin_error, sig_bin_content, bkg_bin_content, bkg_bin_error);
 
-              other_frac = sqrt(bkg_bin_error*bkg_bin_error - sample_bin_error*sample_bin_error);             
+    for(TString processName : processNames_) {
 
-              if(pruneBinByBin_) {
+      if (processName.Contains("data") || processName.Contains("allmc")) continue;
 
-                // MC stat. prunining method
-                /* NOTE: Information obtained from the following resources
-                   https://twiki.cern.ch/twiki/bin/view/CMS/TTbarHbbRun2ReferenceAnalysisLimits
-                   https://indico.cern.ch/event/373752/session/6/contribution/15/attachments/744533/1021297/Hbb_bbbStat_24022015.pdf
-                   https://github.com/cms-ttH/ttH-Limits/blob/13TeV/python/datacard_ttbb13TeV.py
-                 */
-                if(bkg_bin_error < data_bin_error/5.
-                   || sig_bin_content/bkg_bin_content < 0.01
-                   || sample_bin_content < 0.01
-                   || other_frac/bkg_bin_error > 0.95) {
-                  continue;
-                }
-              }
+      HistogramAccumulator sample_hist;
+      if(!this->accumulate(sample_hist, nominalFile, name+"_"+processName, *nominal)) continue;
 
-              // Extract both histogram statistical error and bin content
-              const float error   = mapOfNominalHisto[processName]->GetBinError(iBin+1);
-              const float content = mapOfNominalHisto[processName]->GetBinContent(iBin+1);
+      // Evaluate pruning and shifted bin contents for all bins at once
+      std::vector<double> sample_bin_content, sample_bin_error;
+      sample_hist.binContents(sample_bin_content, sample_bin_error);
+      engine.evaluate(sample_bin_content, sample_bin_error, pruneBinByBin_);
 
-              // Create shifted histogram
-              TH1* histo = (TH1*)mapOfNominalHisto[processName]->Clone();
-              const float shifted_content = std::max(content + shift.second*error, float(1e-8));
-              histo->SetBinContent(iBin+1, shifted_content);
+      const char* histo_Bin = convertLabel(convertSampleNames_, processName.Data()).c_str();
 
-              const char* histo_Bin = convertSampleNames_[processName.Data()].c_str();
-              TString histo_name  = TString::Format("CMS_ttH_%s_%s_13TeV_%sbin%d",histo_Bin, mapOfCategories_[eventCategory.Data()].c_str(), observableType_.c_str(), iBin+1);
+      for(auto shift : shiftUpDown){
 
-              outputFile_ = new TFile(TString(outputDirDatacard_+outputFileName_),"UPDATE");
-              outputFile_->cd(TString(mapOfCategories_[eventCategory.Data()]+"_"+observableType_));
+        const std::vector<float>& shifted_content = engine.shiftedContent(shift.second);
 
-              // Only need to include statistical uncertainties for both signal and background once in the datacard
-              if(shift.first.Contains("Down")) {
+        // Only nuisances surviving the pruning are written
+        for(size_t iBin : engine.survivingBins()) {
 
-                datacard_  << TString::Format("%-32s shape\t", histo_name.Data());
+          TString histo_name  = TString::Format("CMS_ttH_%s_%s_13TeV_%sbin%d",histo_Bin, job.category.c_str(), observableType_.c_str(), (int)iBin+1);
 
-                for(auto process : processNames_) {
+          // Only need to include statistical uncertainties for both signal and background once in the datacard
+          if(shift.first.Contains("Down")) {
 
-                  if(process == "data" || process == "allmc") continue;
+            job.datacard.column(histo_name.Data(), 32) << " shape\t";
 
-                  // Default value of 1.0 assigned to MC stats shape systematics
-                  if(convertSampleNames_[process] == histo_Bin)
-                    datacard_  << TString::Format("%-8.11s\t", "1.000000");
-                  else
-                    datacard_  << TString::Format("%-8.11s\t", "-");
-                }
+            for(auto process : processNames_) {
 
-                datacard_  << std::endl;
-              }
-              histo->Write(TString(histo_Bin)+"_"+histo_name+(shift.first));
+              if(process == "data" || process == "allmc") continue;
 
-              outputFile_->Write("",TObject::kOverwrite);
-              outputFile_->Close();
+              // Default value of 1.0 assigned to MC stats shape systematics
+              if(convertLabel(convertSampleNames_, process) == histo_Bin)
+                job.datacard.column("1.000000", 8, 11) << "\t";
+              else
+                job.datacard.column("-", 8, 11) << "\t";
             }
+
+            job.datacard  << std::endl;
           }
+
+          // Create shifted histogram
+          const TString shifted_name = TString(histo_Bin)+"_"+histo_name+(shift.first);
+          TH1* histo = sample_hist.histogram(shifted_name);
+          histo->SetBinContent(iBin+1, shifted_content[iBin]);
+
+          this->adopt(job, histo, shifted_name);
         }
       }
     }
   }
   // End statistical uncertainty estimate
-  datacard_.close();
 }
 
 
-void DatacardMaker::extractYields(const std::string& name)
+bool DatacardMaker::accumulate(HistogramAccumulator& sum, const TString& fileName, const TString& histoName, const Systematic::Systematic& systematic)
 {
-  // Parse string into tokens
-  TObjArray* token  = TString(name).Tokenize("_");
-  TString filename  = TString(name);
-  TString eventCategory = ((TObjString*)token->At(token->GetLast()))->GetString();
+  // Histograms to be exported to a new snapshot need to be held by the cache
+  HistogramSnapshot::View view;
+  if(snapshotOutputFile_.empty() && histogramCache_.find(fileName, histoName, systematic, view)){
+    sum += view;
+    return true;
+  }
 
-  if(!datacard_.is_open())
-    datacard_.open(datacardName_, std::ios::out | std::ios::app);
+  const TH1* histo = histogramCache_.get(fileName, histoName, systematic);
+  if(!histo) return false;
 
-  std::map<TString, TString>::iterator systematic; 
-  std::map<TString,TH1D*> mapOfHistograms;
+  sum += *histo;
+  return true;
+}
 
-  TString observationRate;
-  TString signalRate;
 
-  std::map<TString, TString> processRates;
+void DatacardMaker::readYields(DatacardJob& job)
+{
+  DatacardProfiler::Scope profile("readYields");
 
-  TString process;
+  const std::string& name = job.name;
 
-  // Begin iterating through the Plots directory for File System hierarchy
-  if(filename.Contains(eventCategory)) {  
+  // Loop over all systematics and channels
+  for(const auto& channelCollection : job.inputFileLists) {
 
-    // Loop over all systematics and channels
-    for(auto fileCollection = inputFileLists_->begin(); fileCollection != inputFileLists_->end(); ++fileCollection) {
+    for(const auto& uncertainty : channelCollection.second) {
 
-      for(auto uncertainty : (*fileCollection).second) {    
+      const Systematic::Systematic& systematic = uncertainty.first;
+      const std::string& fileName = uncertainty.second.find(name+"_source.root")->second;
 
-        Systematic::Systematic systematic = uncertainty.first;
+      // Incremental mode: inputs whose file is untouched since the last run are not read at all
+      uint64_t recordedFileHash(0), recordedContentHash(0);
+      const bool recorded = job.inputHashes && !job.rebuild && job.inputHashes->find(job.directory, systematic.name().Data(), recordedFileHash, recordedContentHash);
+      const uint64_t fileHash = job.inputHashes ? DatacardInputHashes::fileHash(fileName) : 0;
+      if(recorded && recordedFileHash == fileHash) continue;
 
-        // Create input file handler
-        TFile* sampleFile = new TFile((uncertainty.second.find(name+"_source.root")->second).c_str());
+      // Histograms found in the file by a previous run, only those need to be looked up
+      std::vector<std::string> keyNames;
+      const bool knownKeys = manifest_.keys(fileName, keyNames);
 
-        bool debug_ = false;
-        if(debug_)
-          std::cout << sampleFile->GetName() << std::endl;
+      std::vector<std::string> foundKeyNames;
+      std::map<TString, const TH1*>& histograms = job.yields[systematic];
 
-        // Check that file exists and is not corrupt
-        if(sampleFile->IsZombie()) {
-          std::cout<<"\n\tWe didn't find the "+TString(filename+"_source.root")+" input!!\n";
-        }
-        else {
-        // Update (i.e. append) to output file
-          if(!outputFile_) {
-            outputFile_ = new TFile(TString(outputDirDatacard_+outputFileName_),"RECREATE");
-          }
-          else {
-            outputFile_ = new TFile(TString(outputDirDatacard_+outputFileName_),"UPDATE");
-          }
-          
-          // Create list from list of histogram from root file
-          TList* list = sampleFile->GetListOfKeys();
-
-          bool debug_ = false;
-          if(debug_)list->Print();
-          
-          if(!list) {
-            std::cout << TString::Format("<Error> No keys found in file\n");
-            exit(1);
-          }
-          
-          // Create iterator from list
-          TIter next((TList*)list);
-          TKey* key;
-
-          // Iterate and extract histograms from file
-          while((key=(TKey*)next())){
-            TObjArray *subString;
-            TString processType;
-
-            if(filename == key->GetName()) continue; // ignore TCanvas object normally found in histogram root files
-            subString = TPRegexp(filename+"_(\\w+)").MatchS(TString(key->GetName()));
-            processType  = ((TObjString *)subString->At(1))->GetString();
-
-            if(std::find(processNames_.begin(), processNames_.end(), processType)!= processNames_.end()){ 
-              mapOfHistograms[processType] = (TH1D*)sampleFile->Get(key->GetName());
-            }
-          }
+      // Direct lookup of the histogram of each process, read from file once and shared with the statistical uncertainties
+      for(const auto& process : processNames_) {
+        const std::string histoName(name+"_"+process);
+        if(knownKeys && std::find(keyNames.begin(), keyNames.end(), histoName) == keyNames.end()) continue;
 
-          // Check histogram exist
-          for (std::map<TString,TH1D*>::iterator mvaHisto = mapOfHistograms.begin(); mvaHisto != mapOfHistograms.end(); ++mvaHisto) {
-            if(!mapOfHistograms[mvaHisto->first])
-              std::cout << "\n\tWe didn't find the "+mvaHisto->first+" histogram!!\n";
-          }
+        const TH1* histo = histogramCache_.get(fileName, histoName, systematic);
+        if(!histo) continue;
 
-          // Write histograms to file
-          for(std::map<TString,TH1D*>::iterator mvaHisto = mapOfHistograms.begin(); mvaHisto != mapOfHistograms.end(); ++mvaHisto) {
+        histograms[process] = histo;
+        foundKeyNames.push_back(histoName);
+      }
 
-            if(systematic.type() == Systematic::nominal) {
+      if(histograms.empty()) {
+        std::cout<<"\n\tWe didn't find the "+TString(name+"_source.root")+" input!!\n";
+      }
+      else if(!knownKeys) {
+        manifest_.setKeys(fileName, foundKeyNames);
+      }
 
-              if((mvaHisto->first == "data") || (mvaHisto->first == "allmc")) {
-                observationRate = TString::Format("%f\t", mapOfHistograms[mvaHisto->first]->Integral());
-              }
-              else {
-                processRates[mvaHisto->first] += TString::Format("%f\t", mapOfHistograms[mvaHisto->first]->Integral());
-              }
-            }
-          }
+      // Incremental mode: inputs with unchanged histogram content need not be written again
+      if(job.inputHashes) {
+        const uint64_t contentHash = histogramContentHash(histograms);
+        job.inputHashes->set(job.directory, systematic.name().Data(), fileHash, contentHash);
+        if(recorded && recordedContentHash == contentHash) job.yields.erase(systematic);
+      }
+    }
+  }
+}
 
-          if(systematic.type() == Systematic::nominal) {
 
-            datacard_ << TString::Format("\nbin\t\t%-s",mapOfCategories_[eventCategory.Data()].c_str()) << std::endl;
-            datacard_ << TString::Format("observation\t%-s",observationRate.Data()) << std::endl;
-            datacard_ << "----------------------------------------------------------------------------------------------------------------------" << std::endl;
-            datacard_ << "\nbin\t";
-            for(std::size_t i = 0; i < processNames_.size(); ++i) {
-              if((processNames_[i] != "data") && (processNames_[i] != "allmc")) {
-                datacard_  << TString::Format("%-8s\t", mapOfCategories_[eventCategory.Data()].c_str());
-              }
-            }
-            datacard_ << "\nprocess\t";
+void DatacardMaker::extractYields(DatacardJob& job)
+{
+  DatacardProfiler::Scope profile("extractYields");
 
-            for(auto process : processNames_){
-              if((process == "data") || (process == "allmc")) continue;
-              datacard_  << TString::Format("%-8s\t", convertSampleNames_[process].c_str());
-            }
-            datacard_ << "\nprocess\t"; 
+  TString observationRate;
+  std::map<TString, TString> processRates;
 
-            int index = std::count_if(processNames_.begin(), processNames_.end(), [this](std::string word) {return (word.find(signalModel_) != std::string::npos);});
-            for(std::size_t i = 1; i < processNames_.size(); ++i) {
-              datacard_  << TString::Format("%-8d\t", (Int_t)(i-index));
-            }
+  for(const auto& systematicHistograms : job.yields) {
 
-            datacard_ << "\nrate\t" ;
+    if(systematicHistograms.first.type() != Systematic::nominal) continue;
 
-            for(auto process : processNames_) {
-              if(!list->Contains(TString(process)))
-                datacard_  << TString::Format("%s", processRates[process].Data());
-              else
-                datacard_  << TString::Format("%s", "-999.0");
-            }
-
-            datacard_ << "\n---------------------------------------------------------------------------------------------------------------------" << std::endl;
-          } 
+    for(const auto& histogram : systematicHistograms.second) {
 
-          outputFile_->Write("",TObject::kOverwrite);
-          outputFile_->Close();
-        } // End section where histograms are written
+      if((histogram.first == "data") || (histogram.first == "allmc")) {
+        observationRate = TString::Format("%f\t", histogram.second->Integral());
+      }
+      else {
+        processRates[histogram.first] += TString::Format("%f\t", histogram.second->Integral());
+      }
+    }
 
-        sampleFile->Close();
-        processRates.clear();
+    job.datacard.section(DatacardBuilder::observation) << "\nbin\t\t" << job.category << std::endl;
+    job.datacard << "observation\t" << observationRate << std::endl;
+    job.datacard << "----------------------------------------------------------------------------------------------------------------------" << std::endl;
+    job.datacard.section(DatacardBuilder::rates) << "\nbin\t";
+    for(std::size_t i = 0; i < processNames_.size(); ++i) {
+      if((processNames_[i] != "data") && (processNames_[i] != "allmc")) {
+        job.datacard.column(job.category, 8) << "\t";
       }
     }
+    job.datacard << "\nprocess\t";
+
+    for(auto process : processNames_){
+      if((process == "data") || (process == "allmc")) continue;
+      job.datacard.column(convertLabel(convertSampleNames_, process), 8) << "\t";
+    }
+    job.datacard << "\nprocess\t"; 
+
+    int index = std::count_if(processNames_.begin(), processNames_.end(), [this](std::string word) {return (word.find(signalModel_) != std::string::npos);});
+    for(std::size_t i = 1; i < processNames_.size(); ++i) {
+      job.datacard.column((int)(i-index), 8) << "\t";
+    }
+
+    job.datacard << "\nrate\t" ;
+
+    for(auto process : processNames_) {
+      job.datacard << processRates[process];
+    }
+
+    job.datacard << "\n---------------------------------------------------------------------------------------------------------------------" << std::endl;
   }
-  datacard_.close();
-  return;
 }
 
 
-void DatacardMaker::writeYields(const std::string& name)
+void DatacardMaker::writeYields(DatacardJob& job)
 {
-  // Parse string into tokens
-  TObjArray* token  = TString(name).Tokenize("_");
-  TString filename  = TString(name);
-  TString eventCategory = ((TObjString*)token->At(token->GetLast()))->GetString();
-  
-  std::map<TString, TString>::iterator systematic; 
-  std::map<TString,TH1D*> mapOfHistograms;
-
-  TString observationRate;
-  TString signalRate;
+  DatacardProfiler::Scope profile("writeYields");
 
   TString process;
 
-  // Begin iterating through the Plots directory for File System hierarchy
-  if(filename.Contains(eventCategory)) {  
+  for(const auto& systematicHistograms : job.yields) {
 
-    // Loop over all systematics and channels
-    for(auto fileCollection = inputFileLists_->begin(); fileCollection != inputFileLists_->end(); ++fileCollection) {
+    const Systematic::Systematic& systematic = systematicHistograms.first;
 
-      for(auto uncertainty : (*fileCollection).second) {  
-        
-        Systematic::Systematic systematic = uncertainty.first;
-        
-        // Create input file handler
-        TFile* sampleFile = new TFile((uncertainty.second.find(name+"_source.root")->second).c_str());
+    // Write histograms to file, buffered for the event category directory until the output file is closed
+    for(const auto& histogram : systematicHistograms.second) {
+
+      if((histogram.first == "data" || histogram.first == "allmc") && systematic.type() == Systematic::nominal) {
 
-        bool debug_ = false;
-        if(debug_)
-          std::cout << sampleFile->GetName() << std::endl;
+        process = convertLabel(convertSampleNames_, histogram.first.Data());
+        this->store(job, *histogram.second, process);
+      }
+      else if(histogram.first != "data" && histogram.first != "allmc") {
 
-        // Check that file exists and is not corrupt
-        if(sampleFile->IsZombie()) {
-          std::cout<<"\n\tWe didn't find the "+TString(filename+"_source.root")+" input!!\n";
+        if(systematic.type() == Systematic::nominal) {
+          process = convertLabel(convertSampleNames_, histogram.first.Data());
         }
         else {
-          // Update (i.e. append) to output file
-          if(!outputFile_) {
-            outputFile_ = new TFile(TString(outputDirDatacard_+outputFileName_),"RECREATE");
-          }
-          else {
-            outputFile_ = new TFile(TString(outputDirDatacard_+outputFileName_),"UPDATE");
-          }
+          process = convertLabel(convertSampleNames_, histogram.first.Data())+"_"+convertLabel(convertSystematicLabel_, systematic.name().Data());
+        }
+        this->store(job, *histogram.second, process);
+      }
+    }
+  }
+}
 
-          // Create list from list of histogram from root file
-          TList* list = sampleFile->GetListOfKeys();
 
-          bool debug_ = false;
-          if(debug_)list->Print();
-          
-          if(!list) {
-            std::cout << TString::Format("<Error> No keys found in file\n");
-            exit(1);
-          }
-          
-          // Create iterator from list
-          TIter next((TList*)list);
-          TKey* key;
-          
-          // Iterate and extract histograms from file
-          while((key=(TKey*)next())){
-
-            TObjArray *subString;
-            TString processType;
-            
-            if(filename == key->GetName()) continue; // ignore TCanvas object normally found in histogram root files
-            subString = TPRegexp(filename+"_(\\w+)").MatchS(TString(key->GetName()));
-            processType  = ((TObjString *)subString->At(1))->GetString();
-
-            if(std::find(processNames_.begin(), processNames_.end(), processType)!= processNames_.end()) { 
-              mapOfHistograms[processType] = (TH1D*)sampleFile->Get(key->GetName());
-            }
-          }
+DatacardOutputFile& DatacardMaker::outputFile(const std::string& fileName)
+{
+  std::unique_ptr<DatacardOutputFile>& outputFile = outputFiles_[fileName];
 
-          // Check histogram exist
-          for (std::map<TString,TH1D*>::iterator mvaHisto = mapOfHistograms.begin(); mvaHisto != mapOfHistograms.end(); ++mvaHisto) {
-            if(!mapOfHistograms[mvaHisto->first])
-              std::cout << "\n\tWe didn't find the "+mvaHisto->first+" histogram!!\n";
-          }
-          
-          // Write histograms to correct event category directory
-          if(outputFile_->GetDirectory(TString(mapOfCategories_[eventCategory.Data()]+"_"+observableType_))) {
-              outputFile_->cd(TString(mapOfCategories_[eventCategory.Data()]+"_"+observableType_));
-          }
-          else {
-            outputFile_->mkdir(TString(mapOfCategories_[eventCategory.Data()]+"_"+observableType_),TString(mapOfCategories_[eventCategory.Data()]+"_"+observableType_));
-            outputFile_->cd(TString(mapOfCategories_[eventCategory.Data()]+"_"+observableType_));
-          }
+  // Open output file once per channel, it stays open until all datacards are written (updated in incremental mode,
+  // unless all its datacards are rebuilt)
+  if(!outputFile) {
+    const bool update = incremental_ && !recreatedOutputFiles_.count(fileName);
+    outputFile.reset(new DatacardOutputFile(TString(fileName), update ? "UPDATE" : "RECREATE"));
+  }
 
-          // Write histograms to file
-          for (std::map<TString,TH1D*>::iterator mvaHisto = mapOfHistograms.begin(); mvaHisto != mapOfHistograms.end(); ++mvaHisto) {
-  
-            if((mvaHisto->first == "data" || mvaHisto->first == "allmc") && systematic.type() == Systematic::nominal) {
-  
-              process =  convertSampleNames_[mvaHisto->first.Data()];
-              mapOfHistograms[mvaHisto->first]->Write(process,TObject::kOverwrite);
-            }
-            else if (mvaHisto->first != "data" && mvaHisto->first != "allmc") {
-  
-              if(systematic.type() == Systematic::nominal) {
-                process =  mvaHisto->first;
-                mapOfHistograms[mvaHisto->first]->Write(TString(convertSampleNames_[process.Data()]),TObject::kOverwrite);
-              }
-              else {
-                process =  convertSampleNames_[(mvaHisto->first).Data()]+"_"+convertSystematicLabel_[systematic.name().Data()]; 
-                mapOfHistograms[mvaHisto->first]->Write(process,TObject::kOverwrite);
-              }
-            }
-          }
-          outputFile_->Write("",TObject::kOverwrite);
-          outputFile_->Close();
-        } // End section where histograms are written
-        sampleFile->Close();
-      }
-    }
+  return *outputFile;
+}
+
+
+void DatacardMaker::clearOutputDirectory(const DatacardJob& job)
+{
+  const std::string fileName(job.outputDir+outputFileName_);
+  const TString directory(job.directory);
+
+  // Submitted before any object of the datacard, the writer thread handles them in order
+  writer_->submit([this, fileName, directory]{
+    DatacardProfiler::Scope profile("write", true);
+    this->outputFile(fileName).clear(directory);
+  });
+}
+
+
+void DatacardMaker::store(const DatacardJob& job, const TObject& object, const TString& name)
+{
+  TObject* clone = object.Clone(name);
+
+  // Keep the copy away from the current ROOT directory, it is owned by the output file buffer
+  if(clone->InheritsFrom(TH1::Class())) static_cast<TH1*>(clone)->SetDirectory(0);
+
+  this->adopt(job, clone, name);
+}
+
+
+void DatacardMaker::adopt(const DatacardJob& job, TObject* object, const TString& name)
+{
+  const std::string fileName(job.outputDir+outputFileName_);
+  const TString directory(job.directory);
+
+  // Each adopted object is a copy made for the output file
+  DatacardProfiler::count(DatacardProfiler::clones);
+
+  // All output root file access goes through the single writer thread
+  writer_->submit([this, fileName, directory, object, name]{
+    DatacardProfiler::Scope profile("write", true);
+    this->outputFile(fileName).adopt(directory, object, name);
+  });
+}
+
+
+DatacardMaker::SystematicClassification::SystematicClassification():
+  kind(skip),
+  label(""),
+  values(NULL),
+  fileListName("")
+{}
+
+
+void DatacardMaker::initializeSystematicClassification()
+{
+  systematicClassification_.clear();
+
+  auto entry = [this](const Systematic::Type type) -> SystematicClassification& {
+    if(static_cast<size_t>(type) >= systematicClassification_.size()) systematicClassification_.resize(type+1);
+    return systematicClassification_.at(type);
+  };
+
+  for(const auto& systematicByType : listOfSystematicsByType_) {
+
+    SystematicClassification& systematicClassification = entry(Systematic::convertType(TString(systematicByType.first)));
+
+    // A type declared as shape is never overwritten by lnN
+    if(systematicByType.second == "shape") systematicClassification.kind = shape;
+    else if(systematicByType.second == "lnN" && systematicClassification.kind != shape) systematicClassification.kind = lnN;
+
+    // Nuisance parameter name, i.e. the CMS label of the up variation without suffix "Up"
+    const std::string& labelUp = convertLabel(convertSystematicLabel_, systematicByType.first+"_UP");
+    systematicClassification.label = labelUp.size() > 2 ? labelUp.substr(0, labelUp.size()-2) : "";
+
+    auto values = valueOfSystematicBasedOnProcess_.find(systematicByType.first);
+    systematicClassification.values = values != valueOfSystematicBasedOnProcess_.end() ? &values->second : NULL;
+  }
+
+  // Variations of the single ttbar components are stored in the input files of the inclusive variation
+  const std::vector<std::pair<std::string, std::vector<Systematic::Type> > > sharedFileLists = {
+    {"SCALE",   {Systematic::scale_ttb, Systematic::scale_ttbb, Systematic::scale_tt2b, Systematic::scale_ttcc, Systematic::scale_ttother}},
+    {"MESCALE", {Systematic::meScale_ttb, Systematic::meScale_ttbb, Systematic::meScale_tt2b, Systematic::meScale_ttcc, Systematic::meScale_ttother}},
+    {"PSSCALE", {Systematic::psScale_ttb, Systematic::psScale_ttbb, Systematic::psScale_tt2b, Systematic::psScale_ttcc, Systematic::psScale_ttother}},
+  };
+
+  for(const auto& sharedFileList : sharedFileLists) {
+    for(Systematic::Type type : sharedFileList.second) entry(type).fileListName = sharedFileList.first;
   }
-  return;
 }
 
 
-TH1* DatacardMaker::addOrCreateHisto(TH1* base, const TH1* const add_histo) const
+const DatacardMaker::SystematicClassification& DatacardMaker::classification(const Systematic::Type type)const
 {
-  TH1* tmp;
-  if(!base) {
-    tmp = static_cast<TH1*>(add_histo->Clone());
-    for(int iBin = 0; iBin < tmp->GetNbinsX(); ++iBin) {
-      const float content = std::max(tmp->GetBinContent(iBin+1), 1e-8);
-      
-      tmp->SetBinContent(iBin+1, content);
+  static const SystematicClassification notClassified;
+
+  return static_cast<size_t>(type) < systematicClassification_.size() ? systematicClassification_[type] : notClassified;
+}
+
+
+uint64_t DatacardMaker::histogramContentHash(const std::map<TString, const TH1*>& histograms)const
+{
+  uint64_t hash = DatacardManifest::hash("");
+
+  for(const auto& histogram : histograms) {
+    const TH1* histo = histogram.second;
+    std::vector<double> values;
+    for(int iBin = 0; iBin <= histo->GetNbinsX()+1; ++iBin) {
+      values.push_back(histo->GetXaxis()->GetBinLowEdge(iBin));
+      values.push_back(histo->GetBinContent(iBin));
+      values.push_back(histo->GetBinError(iBin));
     }
-    base = (TH1*)tmp->Clone();
+    hash = DatacardManifest::hash(histogram.first.Data(), hash);
+    hash = DatacardManifest::hash(std::string(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(double)), hash);
   }
-  else {
-    TH1* tmp = static_cast<TH1*>(add_histo->Clone());
-    for(int iBin = 0; iBin < tmp->GetNbinsX(); ++iBin) {
-      const float content = std::max(tmp->GetBinContent(iBin+1), 1e-8);
-      
-      tmp->SetBinContent(iBin+1, content);
-    }
-    base->Add(tmp);
+
+  return hash;
+}
+
+
+uint64_t DatacardMaker::configurationHash()const
+{
+  uint64_t hash = DatacardManifest::hash(outputFileName_);
+
+  for(const auto& process : processNames_) hash = DatacardManifest::hash(process, hash);
+  for(const auto& systematic : v_systematic_) hash = DatacardManifest::hash(systematic.name().Data(), hash);
+  for(const auto& label : convertSampleNames_) hash = DatacardManifest::hash(label.first+"\t"+label.second, hash);
+  for(const auto& label : convertSystematicLabel_) hash = DatacardManifest::hash(label.first+"\t"+label.second, hash);
+  for(const auto& row : systematicRows_) hash = DatacardManifest::hash(row, hash);
+  for(const auto& cell : systematicCells_) hash = DatacardManifest::hash(cell, hash);
+
+  hash = DatacardManifest::hash(TString::Format("%d %d %d %d %g", addSystematicUncertainty_, addStatisticalUncertainty_, pruneBinByBin_, statisticalUncertaintyMode_, autoMCStatsThreshold_).Data(), hash);
+
+  return hash;
+}
+
+
+TString DatacardMaker::inputFileListName(const Channel::Channel& channel, const Systematic::Systematic& systematic)const
+{
+  const SystematicClassification& systematicClassification = classification(systematic.type());
+
+  // Variations sharing the file list of another variation (e.g. the ttbar components of the scale variations)
+  if(!systematicClassification.fileListName.empty()) {
+    TString tmp = systematic.name().Contains("_UP") ? systematicClassification.fileListName+"_UP" : systematicClassification.fileListName+"_DOWN";
+    return fileList_base_+"/"+"HistoFileList_"+tmp+"_"+Channel::convert(channel)+".txt";
   }
 
-  return base;
+  return fileList_base_+"/"+"HistoFileList_"+systematic.name()+"_"+Channel::convert(channel)+".txt";
 }
 
+
+const std::string& DatacardMaker::convertLabel(const std::map<std::string, std::string>& labels, const std::string& label) const
+{
+  static const std::string noLabel("");
+
+  auto converted = labels.find(label);
+  return converted != labels.end() ? converted->second : noLabel;
+}
+
+
 void DatacardMaker::setIncludeSystmeticUncertainties(bool useSys) {
   
   addSystematicUncertainty_ = useSys;
@@ -1802,3 +1684,32 @@ void DatacardMaker::setIncludeStatisticalUncertainties(bool useStat) {
   addStatisticalUncertainty_ = useStat;
 }
 
+void DatacardMaker::setNumberOfThreads(int numberOfThreads) {
+
+  numberOfThreads_ = numberOfThreads > 0 ? numberOfThreads : 1;
+}
+
+void DatacardMaker::setSnapshotInput(const std::string& fileName) {
+
+  snapshotInputFile_ = fileName;
+}
+
+void DatacardMaker::setSnapshotOutput(const std::string& fileName) {
+
+  snapshotOutputFile_ = fileName;
+}
+
+void DatacardMaker::setIncremental(bool incremental) {
+
+  incremental_ = incremental;
+}
+
+void DatacardMaker::setStatisticalUncertaintyMode(const std::string& mode) {
+
+  if(mode == "binByBin") statisticalUncertaintyMode_ = binByBin;
+  else if(mode == "autoMCStats") statisticalUncertaintyMode_ = autoMCStats;
+  else {
+    std::cerr << "Error in DatacardMaker! Unknown statistical uncertainty mode: " << mode << " (valid: binByBin, autoMCStats)\n...break\n" << std::endl;
+    exit(13);
+  }
+}
@@ -5,6 +5,7 @@
 #include <set>
 #include <map>
 #include <string>
+#include <memory>
 
 #include <TString.h>
 #include <TFile.h>
@@ -12,11 +13,21 @@
 //class TLegend;
 class RootFileReader;
 class TH1;
+class TObject;
+class DatacardInputHashes;
+class HistogramAccumulator;
 
 #include "plotterHelpers.h"
 #include "SamplesFwd.h"
 #include "Sample.h"
 #include "../../common/include/sampleHelpers.h"
+#include "DatacardOutputFile.h"
+#include "DatacardHistogramCache.h"
+#include "ThreadPool.h"
+#include "DatacardBuilder.h"
+#include "HistoFileListIndex.h"
+#include "DatacardManifest.h"
+#include "HistogramSnapshot.h"
 
 #include <fstream>
 
@@ -38,27 +49,102 @@ class DatacardMaker{
 		const std::string& fileLists,
 		const std::string& configname);
 
+  /// Constructor, with input root file and process names given explicitly instead of read from a HistoList config (e.g. for benchmarks)
+  DatacardMaker(const AnalysisConfig& analysisConfig,
+		const std::vector<std::string>& fileNames,
+		const std::vector<std::string>& processNames,
+		const std::vector<Channel::Channel>& v_channel,
+		const std::vector<Systematic::Systematic>& v_systematic,
+		const std::string& fileLists);
+
   /// Destructor
   ~DatacardMaker(){};
+
+  /// State of the production of one datacard, i.e. of one event category and channel
+  struct DatacardJob{
+
+    /// Constructor
+    DatacardJob(const std::string& name_, const Channel::Channel& channel_);
+
+    /// Name of the mva config (i.e. the input root file name without suffix)
+    const std::string name;
+
+    /// Channel of the datacard
+    const Channel::Channel channel;
+
+    /// Event category label following the CMS ttH collaboration naming convention
+    std::string category;
+
+    /// Output root file directory holding the histograms of the event category
+    std::string directory;
+
+    /// Datacard output directory
+    std::string outputDir;
+
+    /// File name of the datacard
+    std::string datacardName;
+
+    /// Datacard text, written to file once complete
+    DatacardBuilder datacard;
+
+    /// Input root files of the datacard, per systematic
+    std::map<Channel::Channel, std::map<Systematic::Systematic, std::map<std::string, std::string > > > inputFileLists;
+
+    /// Input histograms of the datacard per systematic and process, owned by the histogram cache
+    std::map<Systematic::Systematic, std::map<TString, const TH1*> > yields;
+
+    /// Record of the inputs of the output root file in incremental mode, NULL otherwise
+    DatacardInputHashes* inputHashes;
+
+    /// Whether all outputs of the datacard are written from scratch, else only those whose inputs changed (incremental mode)
+    bool rebuild;
+  };
     
-  /// Write the datacards for limit setting tool for all mva config
+  /// Write the datacards for limit setting tool for all mva config, in parallel if more than one thread is set
   void writeDatacards();
+
+  /// Write the datacard of one event category and channel
+  void writeDatacard(DatacardJob& job);
   
   /// Write datacard header
-  void writeHeader(const std::string& name);
+  void writeHeader(DatacardJob& job);
 
   /// Write histogram and body of datacard
-  void writeSystematicUncertainties();
+  void writeSystematicUncertainties(DatacardJob& job);
+
+  /// Read the histograms of all processes and systematics from the input root files, each file opened once
+  void readYields(DatacardJob& job);
 
   /// Handles datacard header and signal, observed, and background yield printouts
-  void extractYields(const std::string& name);
+  void extractYields(DatacardJob& job);
   
   /// Handles writing histogram to output root file 
-  void writeYields(const std::string& name);
+  void writeYields(DatacardJob& job);
 
   void setIncludeSystmeticUncertainties(bool useSys);
   void setIncludeStatisticalUncertainties(bool useStat);
 
+  /// Number of datacards produced in parallel (1 for serial production)
+  void setNumberOfThreads(int numberOfThreads);
+
+  /// Take the input histograms from the given snapshot file where available, instead of the input root files
+  void setSnapshotInput(const std::string& fileName);
+
+  /// Write all input histograms to the given snapshot file after the datacards are produced
+  void setSnapshotOutput(const std::string& fileName);
+
+  /// Write only the datacards and histograms whose inputs changed since the previous run
+  void setIncremental(bool incremental);
+
+  /// File name of the manifest of resolved inputs, written at the end of each run
+  const std::string& manifestFileName()const{return manifestFileName_;}
+
+  /// Modes of the MC statistical uncertainties
+  enum StatisticalUncertaintyMode{binByBin, autoMCStats};
+
+  /// Set mode of the MC statistical uncertainties, valid: binByBin, autoMCStats
+  void setStatisticalUncertaintyMode(const std::string& mode);
+
  private:
    
    /// Pair of a legend entry and the histogram for the corresponding sample
@@ -68,9 +154,6 @@ class DatacardMaker{
    /// Process datacard writer
    void writeVariations(const SystematicHistoMap& histoCollection, const Channel::Channel channel, const std::string processName);
 
-   /// Either creates or addes to the current histogram
-   TH1* addOrCreateHisto(TH1* base, const TH1* const add_histo) const;
-
    /// Signal model (either SM or BSM)
    const char* signalModel_;
 
@@ -86,6 +169,9 @@ class DatacardMaker{
    /// Output file name
    const char* outputFileName_;
 
+   /// File name of the manifest of resolved inputs, kept between runs
+   const std::string manifestFileName_;
+
    /// Include systematic uncertainty in datacard
    bool addSystematicUncertainty_;
 
@@ -95,11 +181,11 @@ class DatacardMaker{
    /// Reference to the analysis config                                                                                          
    const AnalysisConfig& analysisConfig_;
 
-   /// Samples to be analysed
-   std::map<Channel::Channel, std::map<Systematic::Systematic, std::map<std::string, std::string > > >* inputFileLists_;
-
    /// Write statistical uncertainties
-   void writeStatisticalUncertainties(const std::string& name);
+   void writeStatisticalUncertainties(DatacardJob& job);
+
+   /// Add input histogram to the sum, read in place from the snapshot where possible, returns false if it does not exist
+   bool accumulate(HistogramAccumulator& sum, const TString& fileName, const TString& histoName, const Systematic::Systematic& systematic);
 
    /// Convert internal systematic uncertainty labeling to CMS ttH collaboration naming convention
    std::map<std::string, std::string> convertSampleNames_;
@@ -113,32 +199,83 @@ class DatacardMaker{
    /// File reader for accessing specific histogram from given file
    RootFileReader* fileReader_;
 
+   /// Input histograms, each read once per run
+   DatacardHistogramCache histogramCache_;
+
    /// Vector of process names obtained from steering parameter file
    std::vector<std::string> processNames_;
    
    /// Vector of root file names (i.e. corresponding to the BDT configs)
    std::vector<std::string> fileNames_;
 
-   /// Complete directory path and input output file name
-   std::string eventFileString_;
-      
-   /// File name of the datacard
-   std::string datacardName_;
-   
-   /// Datacard output file handler
-   std::ofstream datacard_;
-   
-   /// Datacard output directory
-   std::string outputDirDatacard_;
-   
-   /// Datacard file hanlder
-   TFile* outputFile_;
+   /// Input root files of all file lists, filled once before the datacards are produced
+   HistoFileListIndex fileListIndex_;
+
+   /// Resolved process names, file lists and histogram keys, reused by the next run if its inputs are unchanged
+   DatacardManifest manifest_;
+
+   /// Name of the file list holding the input root files of given channel and systematic
+   TString inputFileListName(const Channel::Channel& channel, const Systematic::Systematic& systematic)const;
+
+   /// Snapshot file to take the input histograms from, empty if not used
+   std::string snapshotInputFile_;
+
+   /// Snapshot file to write the input histograms to, empty if not used
+   std::string snapshotOutputFile_;
+
+   /// Memory-mapped input histogram snapshot, open while the datacards are produced
+   std::unique_ptr<HistogramSnapshot> snapshot_;
+
+   /// Output root file sessions, one per channel output directory, kept open for the whole run
+   std::map<std::string, std::unique_ptr<DatacardOutputFile> > outputFiles_;
+
+   /// Access the output root file session with given name, opening it at first access (writer thread only)
+   DatacardOutputFile& outputFile(const std::string& fileName);
+
+   /// Output root files recreated in incremental mode, as all datacards written into them are rebuilt
+   std::set<std::string> recreatedOutputFiles_;
+
+   /// Remove the event category directory of the datacard with all its content from the output root file
+   void clearOutputDirectory(const DatacardJob& job);
+
+   /// Buffer a copy of the object for the event category directory of the datacard
+   void store(const DatacardJob& job, const TObject& object, const TString& name);
+
+   /// Buffer the object for the event category directory of the datacard, taking ownership of it
+   void adopt(const DatacardJob& job, TObject* object, const TString& name);
+
+   /// Single writer thread serializing all access to the output root files
+   std::unique_ptr<ThreadPool> writer_;
+
+   /// Convert label without modifying the map (empty if not found), safe for concurrent datacard production
+   const std::string& convertLabel(const std::map<std::string, std::string>& labels, const std::string& label)const;
    
    /// Obserable type used in analysis (i.e. event classification)
    std::string observableType_;
 
    /// Set to true to apply MC bin-by-bin statistical shape uncertainty pruning
    bool pruneBinByBin_;
+
+   /// Number of datacards produced in parallel
+   size_t numberOfThreads_;
+
+   /// Either one shape nuisance per process and bin, or one aggregate autoMCStats directive per event category
+   StatisticalUncertaintyMode statisticalUncertaintyMode_;
+
+   /// Event threshold below which autoMCStats uses per-process nuisances (Barlow-Beeston) instead of a single per-bin one
+   double autoMCStatsThreshold_;
+
+   /// Write only outputs whose inputs changed since the previous run
+   bool incremental_;
+
+   /// Records of the inputs per output root file, in incremental mode
+   std::map<std::string, std::unique_ptr<DatacardInputHashes> > inputHashes_;
+
+   /// Hash of everything the datacards depend on apart from the input histograms
+   uint64_t configurationHash()const;
+
+   /// Hash of the binning and content of the histograms
+   uint64_t histogramContentHash(const std::map<TString, const TH1*>& histograms)const;
    
    /// Assign lnN type systematic value based on process type
    std::map<std::string,std::vector<std::pair<std::string, std::string>>> valueOfSystematicBasedOnProcess_;
@@ -152,6 +289,49 @@ class DatacardMaker{
    /// Alternative list of systematic uncertainty by type
    std::vector<std::pair<std::string,std::string>> listOfSystematicsByType_;
 
+   /// Kind of systematic uncertainty in the datacard, skip for those not written
+   enum SystematicKind{skip, shape, lnN};
+
+   /// Classification of a systematic uncertainty type for the datacard
+   struct SystematicClassification{
+
+     /// Constructor, for a systematic uncertainty not written to the datacard
+     SystematicClassification();
+
+     /// Kind of systematic uncertainty
+     SystematicKind kind;
+
+     /// Nuisance parameter name following the CMS ttH collaboration naming convention
+     std::string label;
+
+     /// Uncertainty values per process (or for "all" processes), NULL if none assigned
+     const std::vector<std::pair<std::string, std::string> >* values;
+
+     /// Name of the file list shared with another variation (e.g. SCALE), empty if the variation has its own
+     std::string fileListName;
+   };
+
+   /// Classification of the systematic uncertainties, indexed by Systematic::Type
+   std::vector<SystematicClassification> systematicClassification_;
+
+   /// Build the classification table from the lists of systematic uncertainties, labels and values
+   void initializeSystematicClassification();
+
+   /// Classification of the given systematic type
+   const SystematicClassification& classification(const Systematic::Type type)const;
+
+   /// Pre-format the systematic uncertainty block of the datacard for all processes and systematics
+   void initializeSystematicMatrix();
+
+   /// Row headers of the systematic uncertainty block, i.e. nuisance name and kind
+   std::vector<std::string> systematicRows_;
+
+   /// Number of process columns of the systematic uncertainty block
+   size_t systematicColumns_;
+
+   /// Pre-formatted cells of the systematic uncertainty block, row-major (nuisance row x process column)
+   std::vector<std::string> systematicCells_;
+
    /// Initialzer function for 13 TeV, to assign lnN systematic uncertainty values
    void initialization13TeV(bool pruneOption);
 
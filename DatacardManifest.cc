@@ -0,0 +1,294 @@
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdio>
+#include <algorithm>
+#include <sys/stat.h>
+
+#include "DatacardManifest.h"
+
+
+
+
+
+/// Identifier and format version of the manifest file
+static const char manifestMagic[4] = {'D', 'C', 'M', 'F'};
+static const uint32_t manifestVersion = 1;
+
+
+
+// Binary (native byte order) reading and writing of the manifest content
+static void writeValue(std::ostream& out, const uint64_t value)
+{
+  out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void writeString(std::ostream& out, const std::string& text)
+{
+  writeValue(out, text.size());
+  out.write(text.data(), text.size());
+}
+
+static void writeStrings(std::ostream& out, const std::vector<std::string>& texts)
+{
+  writeValue(out, texts.size());
+  for(const auto& text : texts) writeString(out, text);
+}
+
+// Reading works on the manifest held in memory, sizes read from it are checked against the bytes left,
+// so that a damaged manifest is discarded instead of causing huge allocations
+static uint64_t remainingBytes(std::istringstream& in)
+{
+  return static_cast<uint64_t>(std::max(std::streamsize(0), in.rdbuf()->in_avail()));
+}
+
+static bool readValue(std::istringstream& in, uint64_t& value)
+{
+  return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+static bool readString(std::istringstream& in, std::string& text)
+{
+  uint64_t size(0);
+  if(!readValue(in, size) || size > remainingBytes(in)) return false;
+  text.resize(size);
+  return size == 0 || static_cast<bool>(in.read(&text[0], size));
+}
+
+static bool readStrings(std::istringstream& in, std::vector<std::string>& texts)
+{
+  uint64_t size(0);
+  if(!readValue(in, size) || size > remainingBytes(in)/sizeof(uint64_t)) return false;
+  texts.resize(size);
+  for(auto& text : texts) if(!readString(in, text)) return false;
+  return true;
+}
+
+
+
+DatacardManifest::DatacardManifest():
+queryHash_(0),
+valid_(false),
+modified_(false)
+{}
+
+
+
+bool DatacardManifest::load(const std::string& fileName, const uint64_t queryHash)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  this->reset(queryHash);
+
+  std::ifstream file(fileName.c_str(), std::ios::binary);
+  if(!file) return false;
+  std::ostringstream content;
+  content << file.rdbuf();
+  std::istringstream in(content.str());
+
+  // Check file format and query
+  char magic[sizeof(manifestMagic)];
+  uint64_t version(0), hash(0);
+  if(!in.read(magic, sizeof(magic)) || !std::equal(magic, magic+sizeof(magic), manifestMagic)) return false;
+  if(!readValue(in, version) || version != manifestVersion) return false;
+  if(!readValue(in, hash) || hash != queryHash) return false;
+
+  bool ok(true);
+  uint64_t size(0);
+
+  // Check that none of the input files changed
+  ok = ok && readValue(in, size);
+  for(uint64_t i = 0; ok && i < size; ++i){
+    std::string dependency;
+    uint64_t time(0), fileSize(0);
+    ok = readString(in, dependency) && readValue(in, time) && readValue(in, fileSize);
+
+    FileStamp stamp;
+    ok = ok && fileStamp(dependency, stamp) && stamp == FileStamp(time, fileSize);
+    if(ok) dependencies_[dependency] = stamp;
+  }
+
+  ok = ok && readStrings(in, processNames_) && readStrings(in, fileNames_);
+
+  ok = ok && readValue(in, size);
+  for(uint64_t i = 0; ok && i < size; ++i){
+    std::string fileListName;
+    std::vector<std::string> baseNames, paths;
+    ok = readString(in, fileListName) && readStrings(in, baseNames) && readStrings(in, paths) && baseNames.size() == paths.size();
+
+    FileListEntries& entries = fileLists_[fileListName];
+    for(size_t iEntry = 0; ok && iEntry < baseNames.size(); ++iEntry) entries.push_back(std::make_pair(baseNames[iEntry], paths[iEntry]));
+  }
+
+  ok = ok && readValue(in, size);
+  for(uint64_t i = 0; ok && i < size; ++i){
+    std::string rootFileName;
+    ok = readString(in, rootFileName) && readStrings(in, keys_[rootFileName]);
+  }
+
+  if(!ok){
+    this->reset(queryHash);
+    return false;
+  }
+
+  valid_ = true;
+  return true;
+}
+
+
+
+bool DatacardManifest::save(const std::string& fileName)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if(!modified_) return true;
+
+  // Write to a temporary file first, so that an interrupted run never leaves a truncated manifest
+  const std::string temporaryFileName(fileName+".tmp");
+  std::ofstream out(temporaryFileName.c_str(), std::ios::binary | std::ios::trunc);
+  if(!out){
+    std::cerr << "Warning in DatacardManifest! Cannot write manifest file: " << fileName << std::endl;
+    return false;
+  }
+
+  out.write(manifestMagic, sizeof(manifestMagic));
+  writeValue(out, manifestVersion);
+  writeValue(out, queryHash_);
+
+  writeValue(out, dependencies_.size());
+  for(const auto& dependency : dependencies_){
+    writeString(out, dependency.first);
+    writeValue(out, dependency.second.first);
+    writeValue(out, dependency.second.second);
+  }
+
+  writeStrings(out, processNames_);
+  writeStrings(out, fileNames_);
+
+  writeValue(out, fileLists_.size());
+  for(const auto& fileList : fileLists_){
+    std::vector<std::string> baseNames, paths;
+    for(const auto& entry : fileList.second){
+      baseNames.push_back(entry.first);
+      paths.push_back(entry.second);
+    }
+    writeString(out, fileList.first);
+    writeStrings(out, baseNames);
+    writeStrings(out, paths);
+  }
+
+  writeValue(out, keys_.size());
+  for(const auto& keyNames : keys_){
+    writeString(out, keyNames.first);
+    writeStrings(out, keyNames.second);
+  }
+
+  out.close();
+  if(!out || std::rename(temporaryFileName.c_str(), fileName.c_str()) != 0){
+    std::cerr << "Warning in DatacardManifest! Cannot write manifest file: " << fileName << std::endl;
+    std::remove(temporaryFileName.c_str());
+    return false;
+  }
+
+  modified_ = false;
+  return true;
+}
+
+
+
+void DatacardManifest::addDependency(const std::string& fileName)
+{
+  FileStamp stamp;
+  if(!fileStamp(fileName, stamp)) return;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto dependency = dependencies_.find(fileName);
+  if(dependency != dependencies_.end() && dependency->second == stamp) return;
+
+  dependencies_[fileName] = stamp;
+  modified_ = true;
+}
+
+
+
+void DatacardManifest::setHistoList(const std::vector<std::string>& processNames, const std::vector<std::string>& fileNames)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  processNames_ = processNames;
+  fileNames_ = fileNames;
+  modified_ = true;
+}
+
+
+
+void DatacardManifest::setFileList(const std::string& fileListName, const FileListEntries& entries)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  FileListEntries& fileList = fileLists_[fileListName];
+  if(fileList == entries) return;
+
+  fileList = entries;
+  modified_ = true;
+}
+
+
+
+bool DatacardManifest::keys(const std::string& fileName, std::vector<std::string>& keyNames)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto fileKeys = keys_.find(fileName);
+  if(fileKeys == keys_.end()) return false;
+
+  keyNames = fileKeys->second;
+  return true;
+}
+
+
+
+void DatacardManifest::setKeys(const std::string& fileName, const std::vector<std::string>& keyNames)
+{
+  this->addDependency(fileName);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  keys_[fileName] = keyNames;
+  modified_ = true;
+}
+
+
+
+uint64_t DatacardManifest::hash(const std::string& text, uint64_t value)
+{
+  for(const unsigned char character : text){
+    value ^= character;
+    value *= 1099511628211ULL;
+  }
+
+  // Separator, so that concatenated texts of different split hash differently
+  value ^= 0xff;
+  value *= 1099511628211ULL;
+
+  return value;
+}
+
+
+
+bool DatacardManifest::fileStamp(const std::string& fileName, FileStamp& stamp)
+{
+  struct stat status;
+  if(stat(fileName.c_str(), &status) != 0) return false;
+
+  stamp = FileStamp(static_cast<int64_t>(status.st_mtime), static_cast<uint64_t>(status.st_size));
+  return true;
+}
+
+
+
+void DatacardManifest::reset(const uint64_t queryHash)
+{
+  queryHash_ = queryHash;
+  valid_ = false;
+  modified_ = false;
+  dependencies_.clear();
+  processNames_.clear();
+  fileNames_.clear();
+  fileLists_.clear();
+  keys_.clear();
+}
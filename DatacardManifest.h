@@ -0,0 +1,116 @@
+#ifndef DatacardManifest_h
+#define DatacardManifest_h
+
+#include <map>
+#include <vector>
+#include <string>
+#include <utility>
+#include <mutex>
+#include <cstdint>
+
+
+
+
+
+/// Binary on-disk manifest of the resolved inputs of the datacard maker
+/// It holds the process and input file names read from the HistoList config, the content of the histogram file lists,
+/// and the histogram key inventory of the input root files, so that repeated runs with the same query do not re-scan them
+/// The manifest is valid only for the query it was made for (identified by a hash),
+/// and as long as none of the files it was derived from changed (identified by modification time and size)
+/// Access to the key inventory is thread safe
+class DatacardManifest{
+
+ public:
+
+  /// Content of one histogram file list, pairs of file base name and full path
+  typedef std::vector<std::pair<std::string, std::string> > FileListEntries;
+
+  /// Constructor
+  DatacardManifest();
+
+  /// Destructor
+  ~DatacardManifest(){}
+
+  /// Read manifest from file, returns true if it is valid for the query and all its input files are unchanged, else starts empty
+  bool load(const std::string& fileName, const uint64_t queryHash);
+
+  /// Write manifest to file if its content changed since loaded, returns false if writing failed
+  bool save(const std::string& fileName);
+
+  /// Whether the manifest was loaded valid from file
+  bool isValid()const{return valid_;}
+
+  /// Register a file the manifest content is derived from, recording its modification time and size
+  void addDependency(const std::string& fileName);
+
+  /// Set process and input root file names resolved from the HistoList config
+  void setHistoList(const std::vector<std::string>& processNames, const std::vector<std::string>& fileNames);
+
+  /// Process names resolved from the HistoList config
+  const std::vector<std::string>& processNames()const{return processNames_;}
+
+  /// Input root file names resolved from the HistoList config
+  const std::vector<std::string>& fileNames()const{return fileNames_;}
+
+  /// Set content of a histogram file list
+  void setFileList(const std::string& fileListName, const FileListEntries& entries);
+
+  /// Content of all histogram file lists, by file list name
+  const std::map<std::string, FileListEntries>& fileLists()const{return fileLists_;}
+
+  /// Histogram key names of an input root file, returns false if not in the manifest
+  bool keys(const std::string& fileName, std::vector<std::string>& keyNames);
+
+  /// Set histogram key names of an input root file
+  void setKeys(const std::string& fileName, const std::vector<std::string>& keyNames);
+
+  /// Modification time and size of a file, identifying its version for all caches of the datacard inputs
+  typedef std::pair<int64_t, uint64_t> FileStamp;
+
+  /// Modification time and size of the file, returns false if it does not exist
+  static bool fileStamp(const std::string& fileName, FileStamp& stamp);
+
+  /// FNV-1a hash of the text, continuing from a previous hash value
+  static uint64_t hash(const std::string& text, uint64_t value = 14695981039346656037ULL);
+
+ private:
+
+  DatacardManifest(const DatacardManifest&) = delete;
+  DatacardManifest& operator=(const DatacardManifest&) = delete;
+
+  /// Remove all content
+  void reset(const uint64_t queryHash);
+
+  /// Hash of the query the manifest is valid for
+  uint64_t queryHash_;
+
+  /// Whether the manifest was loaded valid from file
+  bool valid_;
+
+  /// Whether the content changed since loaded
+  bool modified_;
+
+  /// Files the content is derived from, with their modification time and size
+  std::map<std::string, FileStamp> dependencies_;
+
+  /// Process names resolved from the HistoList config
+  std::vector<std::string> processNames_;
+
+  /// Input root file names resolved from the HistoList config
+  std::vector<std::string> fileNames_;
+
+  /// Content of the histogram file lists
+  std::map<std::string, FileListEntries> fileLists_;
+
+  /// Histogram key names per input root file
+  std::map<std::string, std::vector<std::string> > keys_;
+
+  /// Protects the dependencies and the key inventory
+  std::mutex mutex_;
+};
+
+
+
+
+
+#endif
@@ -0,0 +1,77 @@
+#include <iostream>
+#include <cstdlib>
+
+#include <TFile.h>
+#include <TDirectory.h>
+#include <TObject.h>
+
+#include "DatacardOutputFile.h"
+#include "DatacardProfiler.h"
+
+
+
+
+
+DatacardOutputFile::DatacardOutputFile(const TString& fileName, const TString& option):
+fileName_(fileName),
+file_(new TFile(fileName, option))
+{
+  if(file_->IsZombie()){
+    std::cerr << "Error in DatacardOutputFile! Cannot create output file: " << fileName_ << "\n...break\n" << std::endl;
+    exit(1);
+  }
+  DatacardProfiler::count(DatacardProfiler::fileOpens);
+}
+
+
+
+DatacardOutputFile::~DatacardOutputFile()
+{
+  this->flush();
+  file_->Close();
+}
+
+
+
+void DatacardOutputFile::clear(const TString& directory)
+{
+  auto buffered = buffer_.find(directory);
+  if(buffered != buffer_.end()){
+    for(auto& object : buffered->second) delete object.second;
+    buffer_.erase(buffered);
+  }
+
+  // Deleting the directory key removes the directory with all its keys
+  if(file_->GetDirectory(directory)) file_->Delete(directory+";*");
+}
+
+
+
+void DatacardOutputFile::adopt(const TString& directory, TObject* object, const TString& name)
+{
+  TObject*& buffered = buffer_[directory][name];
+  if(buffered) delete buffered;
+  buffered = object;
+}
+
+
+
+void DatacardOutputFile::flush()
+{
+  for(auto& directoryObjects : buffer_){
+    const TString& directory = directoryObjects.first;
+
+    TDirectory* dir = file_->GetDirectory(directory);
+    if(!dir) dir = file_->mkdir(directory, directory);
+    dir->cd();
+
+    for(auto& object : directoryObjects.second){
+      object.second->Write(object.first, TObject::kOverwrite);
+      DatacardProfiler::count(DatacardProfiler::writes);
+      delete object.second;
+    }
+  }
+  buffer_.clear();
+
+  file_->cd();
+}
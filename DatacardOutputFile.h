@@ -0,0 +1,60 @@
+#ifndef DatacardOutputFile_h
+#define DatacardOutputFile_h
+
+#include <map>
+#include <memory>
+
+#include <TString.h>
+
+class TFile;
+class TObject;
+
+
+
+
+
+/// Output root file session of the datacard maker
+/// The file is opened once, all objects are buffered in memory per directory,
+/// and written in a single pass when the session is flushed or destroyed
+class DatacardOutputFile{
+
+ public:
+
+  /// Constructor, (re)creating the output file, or updating it with option UPDATE
+  explicit DatacardOutputFile(const TString& fileName, const TString& option = "RECREATE");
+
+  /// Destructor, flushing all buffered objects and closing the file
+  ~DatacardOutputFile();
+
+  /// Remove the directory with all its content from the file, including objects buffered for it
+  void clear(const TString& directory);
+
+  /// Buffer the object to be written into the given directory, taking ownership of it
+  void adopt(const TString& directory, TObject* object, const TString& name);
+
+  /// Write all buffered objects to file, creating the directories where needed
+  void flush();
+
+  /// Name of the output file
+  const TString& fileName()const{return fileName_;}
+
+ private:
+
+  DatacardOutputFile(const DatacardOutputFile&) = delete;
+  DatacardOutputFile& operator=(const DatacardOutputFile&) = delete;
+
+  /// Name of the output file
+  const TString fileName_;
+
+  /// Output file handler
+  std::unique_ptr<TFile> file_;
+
+  /// Buffered objects, per directory and name (a later object with same name overwrites an earlier one)
+  std::map<TString, std::map<TString, TObject*> > buffer_;
+};
+
+
+
+
+
+#endif
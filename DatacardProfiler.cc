@@ -0,0 +1,171 @@
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+#include "DatacardProfiler.h"
+
+
+
+
+
+/// Innermost active scope of the thread
+static thread_local DatacardProfiler::Scope* currentScope = 0;
+
+
+
+DatacardProfiler::Scope::Scope(const char* stage, const bool detached):
+stage_(DatacardProfiler::instance().isEnabled() ? stage : 0),
+enclosing_(0),
+parent_(0),
+counters_(),
+detachedSeconds_(0.)
+{
+  if(!stage_) return;
+
+  enclosing_ = currentScope;
+  parent_ = detached ? 0 : enclosing_;
+  currentScope = this;
+  start_ = std::chrono::steady_clock::now();
+}
+
+
+
+DatacardProfiler::Scope::~Scope()
+{
+  if(!stage_) return;
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count() - detachedSeconds_;
+  currentScope = enclosing_;
+
+  // Counts of the stage are also counts of the enclosing stage, a detached stage is excluded from it also in time
+  if(parent_){
+    for(int counter = 0; counter < numberOfCounters; ++counter) parent_->counters_[counter] += counters_[counter];
+    parent_->detachedSeconds_ += detachedSeconds_;
+  }
+  else if(enclosing_){
+    enclosing_->detachedSeconds_ += seconds + detachedSeconds_;
+  }
+
+  DatacardProfiler::instance().add(stage_, 1, seconds, counters_);
+}
+
+
+
+DatacardProfiler::Stage::Stage():
+calls(0),
+seconds(0.),
+counters()
+{}
+
+
+
+DatacardProfiler::DatacardProfiler():
+enabled_(false)
+{}
+
+
+
+DatacardProfiler& DatacardProfiler::instance()
+{
+  static DatacardProfiler profiler;
+  return profiler;
+}
+
+
+
+void DatacardProfiler::count(const Counter counter, const size_t number)
+{
+  DatacardProfiler& profiler = instance();
+  if(!profiler.isEnabled()) return;
+
+  if(currentScope && currentScope->stage_){
+    currentScope->counters_[counter] += number;
+  }
+  else{
+    size_t counters[numberOfCounters] = {};
+    counters[counter] = number;
+    profiler.add("unscoped", 0, 0., counters);
+  }
+}
+
+
+
+bool DatacardProfiler::writeJson(const std::string& fileName)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::ofstream file(fileName.c_str(), std::ios::trunc);
+
+  file << "{\n  \"stages\": {";
+  bool first(true);
+  for(const auto& stage : stages_){
+    file << (first ? "\n" : ",\n") << "    \"" << stage.first << "\": {"
+         << "\"calls\": " << stage.second.calls << ", \"seconds\": " << stage.second.seconds;
+    for(int counter = 0; counter < numberOfCounters; ++counter){
+      file << ", \"" << counterName(static_cast<Counter>(counter)) << "\": " << stage.second.counters[counter];
+    }
+    file << "}";
+    first = false;
+  }
+  file << "\n  }\n}\n";
+  file.close();
+
+  if(!file){
+    std::cerr << "Warning in DatacardProfiler! Cannot write profile: " << fileName << std::endl;
+    return false;
+  }
+  return true;
+}
+
+
+
+void DatacardProfiler::print(std::ostream& out)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  out << std::left << std::setw(32) << "stage" << std::right << std::setw(8) << "calls" << std::setw(12) << "seconds";
+  for(int counter = 0; counter < numberOfCounters; ++counter) out << std::setw(16) << counterName(static_cast<Counter>(counter));
+  out << "\n";
+
+  for(const auto& stage : stages_){
+    out << std::left << std::setw(32) << stage.first << std::right << std::setw(8) << stage.second.calls
+        << std::setw(12) << std::fixed << std::setprecision(3) << stage.second.seconds << std::defaultfloat;
+    for(int counter = 0; counter < numberOfCounters; ++counter) out << std::setw(16) << stage.second.counters[counter];
+    out << "\n";
+  }
+  out << std::flush;
+}
+
+
+
+void DatacardProfiler::reset()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  stages_.clear();
+}
+
+
+
+void DatacardProfiler::add(const std::string& stage, const size_t calls, const double seconds, const size_t* counters)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  Stage& result = stages_[stage];
+  result.calls += calls;
+  result.seconds += seconds;
+  for(int counter = 0; counter < numberOfCounters; ++counter) result.counters[counter] += counters[counter];
+}
+
+
+
+const char* DatacardProfiler::counterName(const Counter counter)
+{
+  switch(counter){
+    case fileOpens: return "fileOpens";
+    case histogramReads: return "histogramReads";
+    case clones: return "clones";
+    case writes: return "writes";
+    case datacardLines: return "datacardLines";
+    default: return "unknown";
+  }
+}
@@ -0,0 +1,133 @@
+#ifndef DatacardProfiler_h
+#define DatacardProfiler_h
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+
+
+
+
+/// Profiler of the datacard production, collecting per stage the number of calls, the time spent and I/O counters
+/// Stages are measured by scoped timers, counters are attributed to the innermost active stage of the calling thread
+/// (outside of any stage to "unscoped"), times and counters of nested stages are included in the enclosing ones
+/// Detached stages are never included in enclosing ones, neither times nor counters: this is used for work which runs
+/// either on a separate thread or inline depending on the number of threads (e.g. the output writing, always "write"),
+/// so that the results of all stages do not depend on the number of threads
+/// Times of stages running in parallel are summed over all threads
+/// Profiling is disabled by default, then timers and counters cost a single flag check
+class DatacardProfiler{
+
+ public:
+
+  /// Counted operations
+  enum Counter{fileOpens, histogramReads, clones, writes, datacardLines, numberOfCounters};
+
+  /// Scoped timer of a stage, counting the calls and the time until destruction
+  class Scope{
+
+   public:
+
+    /// Constructor, starting the stage (name needs to stay valid for the lifetime of the scope),
+    /// a detached stage is not included in the enclosing stage
+    explicit Scope(const char* stage, const bool detached = false);
+
+    /// Destructor, ending the stage
+    ~Scope();
+
+   private:
+
+    friend class DatacardProfiler;
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    /// Name of the stage, NULL if profiling is disabled
+    const char* stage_;
+
+    /// Enclosing scope of the same thread
+    Scope* enclosing_;
+
+    /// Scope including the results of this one, the enclosing scope unless detached
+    Scope* parent_;
+
+    /// Start time
+    std::chrono::steady_clock::time_point start_;
+
+    /// Counters attributed to this scope, including those of the nested scopes ended so far
+    size_t counters_[numberOfCounters];
+
+    /// Time spent in detached scopes nested in this one so far, excluded from its time
+    double detachedSeconds_;
+  };
+
+  /// Access the profiler
+  static DatacardProfiler& instance();
+
+  /// Enable or disable profiling
+  void setEnabled(const bool enabled){enabled_ = enabled;}
+
+  /// Whether profiling is enabled
+  bool isEnabled()const{return enabled_;}
+
+  /// Count operations for the innermost active stage of the calling thread, and thereby for all enclosing ones
+  static void count(const Counter counter, const size_t number = 1);
+
+  /// Write summary of all stages as JSON, returns false if writing failed
+  bool writeJson(const std::string& fileName);
+
+  /// Print summary of all stages as table
+  void print(std::ostream& out);
+
+  /// Remove all collected results
+  void reset();
+
+ private:
+
+  /// Constructor
+  DatacardProfiler();
+
+  DatacardProfiler(const DatacardProfiler&) = delete;
+  DatacardProfiler& operator=(const DatacardProfiler&) = delete;
+
+  /// Results of a stage
+  struct Stage{
+
+    /// Constructor
+    Stage();
+
+    /// Number of calls
+    size_t calls;
+
+    /// Time spent in seconds
+    double seconds;
+
+    /// Counted operations
+    size_t counters[numberOfCounters];
+  };
+
+  /// Add the results of a scope to its stage
+  void add(const std::string& stage, const size_t calls, const double seconds, const size_t* counters);
+
+  /// Name of the counter in the summary
+  static const char* counterName(const Counter counter);
+
+  /// Whether profiling is enabled
+  std::atomic<bool> enabled_;
+
+  /// Results per stage
+  std::map<std::string, Stage> stages_;
+
+  /// Protects the results
+  std::mutex mutex_;
+};
+
+
+
+
+
+#endif
@@ -0,0 +1,423 @@
+#ifndef EventShapeEngine_h
+#define EventShapeEngine_h
+
+#include <vector>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+
+
+
+
+
+/// Observables computed by the event shape engine, to be combined into its mask
+namespace EventShapeObservable{
+  enum Observable{
+    isotropy = 1<<0,
+    circularity = 1<<1,
+    momentumTensor = 1<<2, // sphericity, aplanarity, C, D and transverse sphericity
+    foxWolfram = 1<<3,
+    all = isotropy | circularity | momentumTensor | foxWolfram
+  };
+}
+
+
+
+/// Engine for the event shapes of a set of momenta, in the floating point type Scalar
+/// Up to MaxInputs momenta are held in the engine itself in contiguous arrays per component, more are stored on the heap.
+/// Only the observables selected in ObservableMask are computed, accessing any other one fails at compile time.
+/// Fox-Wolfram moments are computed up to FoxWolframOrder.
+template<class Scalar, size_t MaxInputs, unsigned int ObservableMask = EventShapeObservable::all, int FoxWolframOrder = 4>
+class EventShapeEngine{
+
+  static_assert(MaxInputs > 0, "EventShapeEngine needs storage for at least one input");
+  static_assert(FoxWolframOrder >= 0, "EventShapeEngine needs a non-negative order of Fox-Wolfram moments");
+
+ public:
+
+  /// Constructor, for no inputs
+  EventShapeEngine();
+
+  /// Destructor
+  ~EventShapeEngine(){}
+
+  /// Set the inputs to the momenta of the objects with given indices, the objects need to provide Px(), Py() and Pz()
+  template<class Object>
+  void setInputs(const std::vector<Object>& objects, const std::vector<int>& indices);
+
+  /// Compute all selected observables for the current inputs, with the momentum tensor weighted by |p|^(r-2)
+  void compute(const Scalar r = 2);
+
+  /// Number of inputs
+  size_t size()const{return numberOfInputs_;}
+
+  /// 1 for spherical events and 0 for events linear in r-phi
+  Scalar isotropy()const{
+    static_assert(ObservableMask & EventShapeObservable::isotropy, "isotropy not selected in EventShapeEngine");
+    return isotropy_;
+  }
+
+  /// 1 for spherical and 0 for linear events in r-phi
+  Scalar circularity()const{
+    static_assert(ObservableMask & EventShapeObservable::circularity, "circularity not selected in EventShapeEngine");
+    return circularity_;
+  }
+
+  /// Eigenvalues v3>=v2>=v1 of the normalised momentum tensor, the largest (smallest) one at index position 0 (2)
+  const Scalar* eigenValues()const{
+    static_assert(ObservableMask & EventShapeObservable::momentumTensor, "momentum tensor not selected in EventShapeEngine");
+    return eigenValues_;
+  }
+
+  /// 1.5*(v1+v2), 1 for spherical, 3/4 for plane and 0 for linear events
+  Scalar sphericity()const{return Scalar(1.5)*(eigenValues()[1] + eigenValues()[2]);}
+
+  /// 1.5*v1, 0.5 for spherical and 0 for plane and linear events
+  Scalar aplanarity()const{return Scalar(1.5)*eigenValues()[2];}
+
+  /// 3*(v1*v2+v1*v3+v2*v3), measures the 3-jet structure of the event
+  Scalar C()const{return 3*(eigenValues()[0]*eigenValues()[1] + eigenValues()[0]*eigenValues()[2] + eigenValues()[1]*eigenValues()[2]);}
+
+  /// 27*v1*v2*v3, measures the 4-jet structure of the event
+  Scalar D()const{return 27*eigenValues()[0]*eigenValues()[1]*eigenValues()[2];}
+
+  /// 2*v2/(v2+v3), 1 for "isotropic-like" and 0 for "pencil-like" events
+  Scalar transSphericity()const{return 2*eigenValues()[1]/(eigenValues()[0] + eigenValues()[1]);}
+
+  /// Fox-Wolfram moment of given order, 0 for orders not computed
+  Scalar H(const int order)const;
+
+  /// Fox-Wolfram moment of given order, which needs to be computed (checked at compile time)
+  template<int Order>
+  Scalar H()const{
+    static_assert(Order >= 0 && Order <= FoxWolframOrder, "Order of Fox-Wolfram moment not computed by EventShapeEngine");
+    return H(Order);
+  }
+
+  /// Ratio of the Fox-Wolfram moment of given order to the 0-th one, 0 if the latter vanishes or the order is not computed
+  Scalar R(const int order)const{return H(0) > 0 ? H(order)/H(0) : 0;}
+
+  /// Closed-form eigenvalues of the symmetric 3x3 matrix given by its components xx, yy, zz, xy, xz, yz,
+  /// the largest (smallest) eigenvalue is stored at index position 0 (2)
+  static void compEigenValues(const Scalar* tensor, Scalar* eigenValues);
+
+ private:
+
+  EventShapeEngine(const EventShapeEngine&) = delete;
+  EventShapeEngine& operator=(const EventShapeEngine&) = delete;
+
+  /// Minimum and maximum over all directions in r-phi of the sum of absolute projected transverse momenta
+  void projectedMomentumSumExtrema(Scalar& minimum, Scalar& maximum)const;
+
+  /// Fill the momentum tensor as its independent components xx, yy, zz, xy, xz, yz
+  void compMomentumTensor(const Scalar r, Scalar* tensor)const;
+
+  /// Compute the Fox-Wolfram moments of all orders in one pass over the pairs of inputs
+  void compFoxWolframMoments();
+
+  /// Number of inputs
+  size_t numberOfInputs_;
+
+  /// Components of the input momenta, pointing either to the local or to the heap storage
+  Scalar* px_;
+  Scalar* py_;
+  Scalar* pz_;
+
+  /// Storage of the input momenta (and of the scratch values) for up to MaxInputs, and for more
+  Scalar localStorage_[4*MaxInputs];
+  std::vector<Scalar> heapStorage_;
+
+  /// Scratch values per input, e.g. magnitude of the momenta or breakpoints in phi
+  Scalar* scratch_;
+
+  /// Results of the computation
+  Scalar isotropy_;
+  Scalar circularity_;
+  Scalar eigenValues_[3];
+  Scalar foxWolframMoments_[FoxWolframOrder+1];
+};
+
+
+
+
+
+template<class Scalar, size_t MaxInputs, unsigned int ObservableMask, int FoxWolframOrder>
+EventShapeEngine<Scalar, MaxInputs, ObservableMask, FoxWolframOrder>::EventShapeEngine():
+numberOfInputs_(0),
+px_(localStorage_),
+py_(localStorage_ + MaxInputs),
+pz_(localStorage_ + 2*MaxInputs),
+scratch_(localStorage_ + 3*MaxInputs),
+isotropy_(0),
+circularity_(0)
+{
+  std::fill(eigenValues_, eigenValues_ + 3, Scalar(0));
+  std::fill(foxWolframMoments_, foxWolframMoments_ + FoxWolframOrder + 1, Scalar(0));
+}
+
+
+
+template<class Scalar, size_t MaxInputs, unsigned int ObservableMask, int FoxWolframOrder>
+template<class Object>
+void EventShapeEngine<Scalar, MaxInputs, ObservableMask, FoxWolframOrder>::setInputs(const std::vector<Object>& objects, const std::vector<int>& indices)
+{
+  numberOfInputs_ = indices.size();
+
+  Scalar* storage = localStorage_;
+  size_t capacity = MaxInputs;
+  if(numberOfInputs_ > MaxInputs){
+    heapStorage_.resize(4*numberOfInputs_);
+    storage = heapStorage_.data();
+    capacity = numberOfInputs_;
+  }
+  px_ = storage;
+  py_ = storage + capacity;
+  pz_ = storage + 2*capacity;
+  scratch_ = storage + 3*capacity;
+
+  for(size_t i = 0; i < numberOfInputs_; ++i){
+    const Object& object = objects.at(indices[i]);
+    px_[i] = object.Px();
+    py_[i] = object.Py();
+    pz_[i] = object.Pz();
+  }
+}
+
+
+
+template<class Scalar, size_t MaxInputs, unsigned int ObservableMask, int FoxWolframOrder>
+void EventShapeEngine<Scalar, MaxInputs, ObservableMask, FoxWolframOrder>::compute(const Scalar r)
+{
+  if(ObservableMask & (EventShapeObservable::isotropy | EventShapeObservable::circularity)){
+    Scalar minimum, maximum;
+    projectedMomentumSumExtrema(minimum, maximum);
+
+    if(ObservableMask & EventShapeObservable::isotropy) isotropy_ = (maximum - minimum)/maximum;
+
+    if(ObservableMask & EventShapeObservable::circularity){
+      Scalar area = 0;
+      for(size_t i = 0; i < numberOfInputs_; ++i) area += std::sqrt(px_[i]*px_[i] + py_[i]*py_[i]);
+      circularity_ = Scalar(3.14159265358979323846)/2*minimum/area;
+    }
+  }
+
+  if(ObservableMask & EventShapeObservable::momentumTensor){
+    Scalar tensor[6];
+    compMomentumTensor(r, tensor);
+    compEigenValues(tensor, eigenValues_);
+  }
+
+  if(ObservableMask & EventShapeObservable::foxWolfram) compFoxWolframMoments();
+}
+
+
+
+template<class Scalar, size_t MaxInputs, unsigned int ObservableMask, int FoxWolframOrder>
+Scalar EventShapeEngine<Scalar, MaxInputs, ObservableMask, FoxWolframOrder>::H(const int order)const
+{
+  static_assert(ObservableMask & EventShapeObservable::foxWolfram, "Fox-Wolfram moments not selected in EventShapeEngine");
+
+  if(order < 0 || order > FoxWolframOrder) return 0;
+
+  return foxWolframMoments_[order];
+}
+
+
+
+/// The sum of absolute projections f(phi) = sum_j |cos(phi)*x_j + sin(phi)*y_j| has period pi and is smooth
+/// except where the direction is perpendicular to an input vector. Between two such breakpoints all signs are fixed,
+/// so f(phi) = A*cos(phi) + B*sin(phi) >= 0 is concave there: its minimum is at a breakpoint and its maximum
+/// either at a breakpoint or at phi = atan2(B,A). Evaluating f at these directions gives the exact extrema.
+template<class Scalar, size_t MaxInputs, unsigned int ObservableMask, int FoxWolframOrder>
+void EventShapeEngine<Scalar, MaxInputs, ObservableMask, FoxWolframOrder>::projectedMomentumSumExtrema(Scalar& minimum, Scalar& maximum)const
+{
+  const Scalar pi = Scalar(3.14159265358979323846);
+
+  auto sum = [this](const Scalar phi){
+    const Scalar cosPhi = std::cos(phi);
+    const Scalar sinPhi = std::sin(phi);
+    Scalar result = 0;
+    for(size_t j = 0; j < numberOfInputs_; ++j) result += std::fabs(cosPhi*px_[j] + sinPhi*py_[j]);
+    return result;
+  };
+
+  // Breakpoints in [0,pi), perpendicular to the transverse momenta
+  Scalar* breakpoints = scratch_;
+  size_t numberOfBreakpoints = 0;
+  for(size_t j = 0; j < numberOfInputs_; ++j){
+    if(px_[j] == 0 && py_[j] == 0) continue;
+    Scalar phi = std::fmod(std::atan2(py_[j], px_[j]) + Scalar(0.5)*pi, pi);
+    if(phi < 0) phi += pi;
+    breakpoints[numberOfBreakpoints++] = phi;
+  }
+  std::sort(breakpoints, breakpoints + numberOfBreakpoints);
+
+  minimum = 0;
+  maximum = 0;
+  if(numberOfBreakpoints == 0) return;
+
+  minimum = sum(breakpoints[0]);
+  maximum = minimum;
+  for(size_t i = 0; i < numberOfBreakpoints; ++i){
+    const Scalar low = breakpoints[i];
+    const Scalar high = i+1 < numberOfBreakpoints ? breakpoints[i+1] : breakpoints[0] + pi;
+    const Scalar value = sum(low);
+    if(value < minimum) minimum = value;
+    if(value > maximum) maximum = value;
+    if(high <= low) continue;
+
+    // Coefficients of the sinusoid between the breakpoints, from the signs at the centre
+    const Scalar cosCentre = std::cos(Scalar(0.5)*(low + high));
+    const Scalar sinCentre = std::sin(Scalar(0.5)*(low + high));
+    Scalar a = 0, b = 0;
+    for(size_t j = 0; j < numberOfInputs_; ++j){
+      const Scalar sign = cosCentre*px_[j] + sinCentre*py_[j] < 0 ? -1 : 1;
+      a += sign*px_[j];
+      b += sign*py_[j];
+    }
+    Scalar stationary = low + std::fmod(std::atan2(b, a) - low, pi);
+    if(stationary < low) stationary += pi;
+    if(stationary < high){
+      const Scalar stationaryValue = sum(stationary);
+      if(stationaryValue > maximum) maximum = stationaryValue;
+    }
+  }
+}
+
+
+
+template<class Scalar, size_t MaxInputs, unsigned int ObservableMask, int FoxWolframOrder>
+void EventShapeEngine<Scalar, MaxInputs, ObservableMask, FoxWolframOrder>::compMomentumTensor(const Scalar r, Scalar* tensor)const
+{
+  for(int i = 0; i < 6; ++i) tensor[i] = 0;
+
+  if(numberOfInputs_ < 2) return;
+
+  Scalar norm = 1;
+  for(size_t i = 0; i < numberOfInputs_; ++i){
+    const Scalar p2 = px_[i]*px_[i] + py_[i]*py_[i] + pz_[i]*pz_[i];
+
+    const Scalar pR = (r == 2) ? p2 : std::pow(p2, Scalar(0.5)*r);
+    norm += pR;
+
+    const Scalar pRminus2 = (r == 2) ? 1 : std::pow(p2, Scalar(0.5)*r - 1);
+
+    tensor[0] += pRminus2*px_[i]*px_[i];
+    tensor[1] += pRminus2*py_[i]*py_[i];
+    tensor[2] += pRminus2*pz_[i]*pz_[i];
+    tensor[3] += pRminus2*px_[i]*py_[i];
+    tensor[4] += pRminus2*px_[i]*pz_[i];
+    tensor[5] += pRminus2*py_[i]*pz_[i];
+  }
+
+  for(int i = 0; i < 6; ++i) tensor[i] *= 1/norm;
+}
+
+
+
+/// Trigonometric solution of the characteristic polynomial of the symmetric matrix
+template<class Scalar, size_t MaxInputs, unsigned int ObservableMask, int FoxWolframOrder>
+void EventShapeEngine<Scalar, MaxInputs, ObservableMask, FoxWolframOrder>::compEigenValues(const Scalar* tensor, Scalar* eigenValues)
+{
+  auto descending = [](const Scalar a, const Scalar b){return a > b;};
+
+  const Scalar offDiagonal = tensor[3]*tensor[3] + tensor[4]*tensor[4] + tensor[5]*tensor[5];
+
+  // diagonal matrix
+  if(offDiagonal == 0){
+    for(int i = 0; i < 3; ++i) eigenValues[i] = tensor[i];
+    std::sort(eigenValues, eigenValues+3, descending);
+    return;
+  }
+
+  // largest eigenvalue from the trigonometric solution of the characteristic polynomial:
+  // eigenvalues of B = (A - q*1)/p are 2*cos(phi + 2*pi*k/3), with det(B) = 2*cos(3*phi)
+  const Scalar q = (tensor[0] + tensor[1] + tensor[2])/3;
+  const Scalar b00 = tensor[0] - q;
+  const Scalar b11 = tensor[1] - q;
+  const Scalar b22 = tensor[2] - q;
+  const Scalar p = std::sqrt((b00*b00 + b11*b11 + b22*b22 + 2*offDiagonal)/6);
+
+  const Scalar determinant = b00*(b11*b22 - tensor[5]*tensor[5])
+                           - tensor[3]*(tensor[3]*b22 - tensor[5]*tensor[4])
+                           + tensor[4]*(tensor[3]*tensor[5] - b11*tensor[4]);
+  const Scalar halfDeterminant = std::max(Scalar(-1), std::min(Scalar(1), Scalar(0.5)*determinant/(p*p*p)));
+  const Scalar phi = std::acos(halfDeterminant)/3;
+
+  eigenValues[0] = q + 2*p*std::cos(phi);
+
+  // the other two solve x^2 - (trace - v0)*x + det(A)/v0 = 0: unlike the trigonometric solution this keeps the precision
+  // of the smallest eigenvalue for (nearly) singular matrices, e.g. from two input vectors, where it vanishes
+  const Scalar determinantA = tensor[0]*(tensor[1]*tensor[2] - tensor[5]*tensor[5])
+                            - tensor[3]*(tensor[3]*tensor[2] - tensor[5]*tensor[4])
+                            + tensor[4]*(tensor[3]*tensor[5] - tensor[1]*tensor[4]);
+  const Scalar sum = std::max(Scalar(0), 3*q - eigenValues[0]);
+  const Scalar product = eigenValues[0] > 0 ? std::max(Scalar(0), determinantA/eigenValues[0]) : 0;
+  eigenValues[1] = (sum + std::sqrt(std::max(Scalar(0), sum*sum - 4*product)))/2;
+  eigenValues[2] = eigenValues[1] > 0 ? product/eigenValues[1] : 0;
+
+  // keep the order for (nearly) degenerate eigenvalues, where rounding can swap them
+  std::sort(eigenValues, eigenValues+3, descending);
+
+  // the momentum tensor is positive semi-definite, negative values are rounding
+  for(int i = 0; i < 3; ++i) eigenValues[i] = std::max(Scalar(0), eigenValues[i]);
+}
+
+
+
+template<class Scalar, size_t MaxInputs, unsigned int ObservableMask, int FoxWolframOrder>
+void EventShapeEngine<Scalar, MaxInputs, ObservableMask, FoxWolframOrder>::compFoxWolframMoments()
+{
+  Scalar sums[FoxWolframOrder+1];
+  std::fill(sums, sums + FoxWolframOrder + 1, Scalar(0));
+  std::fill(foxWolframMoments_, foxWolframMoments_ + FoxWolframOrder + 1, Scalar(0));
+
+  if(numberOfInputs_ == 0) return;
+
+  // Squared magnitudes of the momenta
+  Scalar* magnitude2 = scratch_;
+  for(size_t i = 0; i < numberOfInputs_; ++i) magnitude2[i] = px_[i]*px_[i] + py_[i]*py_[i] + pz_[i]*pz_[i];
+
+  // Legendre polynomials of all orders for the current pair
+  Scalar legendre[FoxWolframOrder+1];
+
+  Scalar s = 0;
+  for(size_t i = 0; i < numberOfInputs_; ++i){
+    const Scalar pmag1 = std::sqrt(magnitude2[i]);
+
+    // pairs with all following candidates, including the candidate itself
+    for(size_t j = i; j < numberOfInputs_; ++j){
+      const Scalar pmag2 = std::sqrt(magnitude2[j]);
+
+      // the cosine of the angle between the two candidates, 1 if one has no momentum
+      const Scalar ptot2 = magnitude2[i]*magnitude2[j];
+      const Scalar dot = px_[i]*px_[j] + py_[i]*py_[j] + pz_[i]*pz_[j];
+      const Scalar cosPhi = ptot2 <= 0 ? 1 : std::max(Scalar(-1), std::min(Scalar(1), dot/std::sqrt(ptot2)));
+
+      // Legendre polynomials P_l(cosPhi) of all orders, by the Bonnet recursion
+      legendre[0] = 1;
+      if(FoxWolframOrder > 0) legendre[1] = cosPhi;
+      for(int l = 2; l <= FoxWolframOrder; ++l)
+        legendre[l] = (cosPhi*(2*l - 1)*legendre[l-1] - (l - 1)*legendre[l-2])/l;
+
+      // the pair enters the sum twice
+      for(int l = 0; l <= FoxWolframOrder; ++l) sums[l] += 2*pmag1*pmag2*legendre[l];
+    }
+
+    // contribution of the candidate with itself, P_l(1) = 1
+    for(int l = 0; l <= FoxWolframOrder; ++l) sums[l] += pmag1*pmag1;
+
+    // total energy
+    s += pmag1;
+  }
+
+  if(s <= 0) return;
+
+  for(int l = 0; l <= FoxWolframOrder; ++l) foxWolframMoments_[l] = sums[l]/(s*s);
+}
+
+
+
+
+
+#endif
@@ -0,0 +1,70 @@
+#include <fstream>
+#include <string>
+
+#include "HistoFileListIndex.h"
+
+
+
+
+
+bool HistoFileListIndex::add(const TString& fileListName, const Channel::Channel& channel, const Systematic::Systematic& systematic)
+{
+  auto fileList = fileLists_.find(fileListName.Data());
+
+  // Read each file list only once
+  if(fileList == fileLists_.end()) {
+    std::ifstream file(fileListName.Data());
+    if(!file) return false;
+
+    FileListEntries entries;
+
+    // Reading each line of the file corresponding to a separate root file
+    std::string line;
+    while(std::getline(file, line)) {
+
+      // Extracting the file name
+      const std::size_t found = line.find_last_of("/\\");
+      entries.push_back(std::make_pair(line.substr(found+1), line));
+    }
+
+    fileList = fileLists_.emplace(fileListName.Data(), entries).first;
+  }
+
+  for(const auto& entry : fileList->second) {
+    files_[key(channel, systematic, entry.first)] = entry.second;
+  }
+
+  return true;
+}
+
+
+
+void HistoFileListIndex::addFileList(const TString& fileListName, const FileListEntries& entries)
+{
+  fileLists_[fileListName.Data()] = entries;
+}
+
+
+
+const std::string& HistoFileListIndex::find(const Channel::Channel& channel, const Systematic::Systematic& systematic, const std::string& baseName)const
+{
+  static const std::string notListed("");
+
+  auto file = files_.find(key(channel, systematic, baseName));
+  return file != files_.end() ? file->second : notListed;
+}
+
+
+
+void HistoFileListIndex::clear()
+{
+  fileLists_.clear();
+  files_.clear();
+}
+
+
+
+std::string HistoFileListIndex::key(const Channel::Channel& channel, const Systematic::Systematic& systematic, const std::string& baseName)
+{
+  return std::string(Channel::convert(channel).Data()) + "/" + systematic.name().Data() + "/" + baseName;
+}
@@ -0,0 +1,67 @@
+#ifndef HistoFileListIndex_h
+#define HistoFileListIndex_h
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+
+#include <TString.h>
+
+#include "../../common/include/sampleHelpers.h"
+
+
+
+
+
+/// Index of the input root files listed in the HistoFileList_<systematic>_<channel>.txt files
+/// Each file list is read only once, even if shared by several systematics, and the root files
+/// are looked up by (channel, systematic, file base name) in constant time
+class HistoFileListIndex{
+
+ public:
+
+  /// Content of one file list, pairs of file base name and full path
+  typedef std::vector<std::pair<std::string, std::string> > FileListEntries;
+
+  /// Constructor
+  HistoFileListIndex(){}
+
+  /// Destructor
+  ~HistoFileListIndex(){}
+
+  /// Register all files of the file list for given channel and systematic, returns false if the file list does not exist
+  bool add(const TString& fileListName, const Channel::Channel& channel, const Systematic::Systematic& systematic);
+
+  /// Provide the content of a file list known beforehand (e.g. from a manifest), so that it is not read from disk
+  void addFileList(const TString& fileListName, const FileListEntries& entries);
+
+  /// Content of all parsed and provided file lists, by file list name
+  const std::unordered_map<std::string, FileListEntries>& fileLists()const{return fileLists_;}
+
+  /// Full path of the root file with given base name, empty if not listed for the channel and systematic
+  const std::string& find(const Channel::Channel& channel, const Systematic::Systematic& systematic, const std::string& baseName)const;
+
+  /// Number of parsed file lists
+  size_t numberOfFileLists()const{return fileLists_.size();}
+
+  /// Remove all entries
+  void clear();
+
+ private:
+
+  /// Key of a root file: channel, systematic and base name of the file
+  static std::string key(const Channel::Channel& channel, const Systematic::Systematic& systematic, const std::string& baseName);
+
+  /// Content of each parsed file list, pairs of file base name and full path
+  std::unordered_map<std::string, FileListEntries> fileLists_;
+
+  /// Full path of each root file by key
+  std::unordered_map<std::string, std::string> files_;
+};
+
+
+
+
+
+#endif
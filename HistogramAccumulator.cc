@@ -0,0 +1,128 @@
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
+
+#include <TH1.h>
+#include <TH1D.h>
+#include <TArrayD.h>
+
+#include "HistogramAccumulator.h"
+
+
+
+
+
+HistogramAccumulator::HistogramAccumulator(const TH1& histo):
+title_(histo.GetTitle()),
+entries_(histo.GetEntries())
+{
+  const int nBins = histo.GetNbinsX();
+
+  edges_.resize(nBins+1);
+  contents_.resize(nBins+2);
+  sumw2_.resize(nBins+2);
+
+  for(int iBin = 0; iBin <= nBins; ++iBin) edges_[iBin] = histo.GetXaxis()->GetBinLowEdge(iBin+1);
+
+  for(int iBin = 0; iBin <= nBins+1; ++iBin){
+    const double error = histo.GetBinError(iBin);
+    contents_[iBin] = histo.GetBinContent(iBin);
+    sumw2_[iBin] = error*error;
+  }
+
+  this->clampContents();
+}
+
+
+
+HistogramAccumulator::HistogramAccumulator(const HistogramSnapshot::View& view):
+title_(view.title),
+entries_(view.entries),
+edges_(view.edges, view.edges + view.numberOfBins+1),
+contents_(view.contents, view.contents + view.numberOfBins+2),
+sumw2_(view.sumw2, view.sumw2 + view.numberOfBins+2)
+{
+  this->clampContents();
+}
+
+
+
+HistogramAccumulator& HistogramAccumulator::operator+=(const HistogramAccumulator& other)
+{
+  if(other.empty()) return *this;
+  if(this->empty()) return *this = other;
+
+  if(other.contents_.size() != contents_.size()){
+    std::cerr << "Error in HistogramAccumulator! Cannot add histograms with different number of bins: "
+              << other.nBins() << " and " << this->nBins() << "\n...break\n" << std::endl;
+    exit(1);
+  }
+
+  const size_t nCells = contents_.size();
+  double* const contents = contents_.data();
+  double* const sumw2 = sumw2_.data();
+  const double* const otherContents = other.contents_.data();
+  const double* const otherSumw2 = other.sumw2_.data();
+
+  for(size_t iCell = 0; iCell < nCells; ++iCell){
+    contents[iCell] += otherContents[iCell];
+    sumw2[iCell] += otherSumw2[iCell];
+  }
+  entries_ += other.entries_;
+
+  return *this;
+}
+
+
+
+HistogramAccumulator& HistogramAccumulator::operator+=(const TH1& histo)
+{
+  return *this += HistogramAccumulator(histo);
+}
+
+
+
+HistogramAccumulator& HistogramAccumulator::operator+=(const HistogramSnapshot::View& view)
+{
+  return *this += HistogramAccumulator(view);
+}
+
+
+
+void HistogramAccumulator::binContents(std::vector<double>& content, std::vector<double>& error)const
+{
+  const size_t nBins = this->nBins();
+  content.resize(nBins);
+  error.resize(nBins);
+
+  for(size_t iBin = 0; iBin < nBins; ++iBin){
+    content[iBin] = contents_[iBin+1];
+    error[iBin] = std::sqrt(sumw2_[iBin+1]);
+  }
+}
+
+
+
+void HistogramAccumulator::clampContents()
+{
+  // Stored with single precision as for the former clamped histogram clones
+  const size_t nBins = this->nBins();
+  for(size_t iBin = 1; iBin <= nBins; ++iBin) contents_[iBin] = static_cast<float>(std::max(contents_[iBin], 1e-8));
+}
+
+
+
+TH1* HistogramAccumulator::histogram(const TString& name)const
+{
+  if(this->empty()) return 0;
+
+  TH1* histo = new TH1D(name, title_.c_str(), this->nBins(), edges_.data());
+  histo->SetDirectory(0);
+  histo->SetContent(contents_.data());
+  histo->Sumw2();
+  histo->GetSumw2()->Set(sumw2_.size(), sumw2_.data());
+  histo->SetEntries(entries_);
+
+  return histo;
+}
@@ -0,0 +1,82 @@
+#ifndef HistogramAccumulator_h
+#define HistogramAccumulator_h
+
+#include <vector>
+#include <string>
+
+#include <TString.h>
+
+class TH1;
+
+#include "HistogramSnapshot.h"
+
+
+
+
+
+/// Lightweight sum of histograms, holding bin edges, bin contents and sums of squared weights in contiguous arrays
+/// Contents of the summed histograms are clamped to a minimum of 1e-8 per bin (as needed for the datacard templates),
+/// a TH1 is created only when the sum is to be written
+class HistogramAccumulator{
+
+ public:
+
+  /// Constructor, for an empty sum
+  HistogramAccumulator():entries_(0.){}
+
+  /// Constructor, from the (clamped) contents of the histogram
+  explicit HistogramAccumulator(const TH1& histo);
+
+  /// Constructor, from the (clamped) contents of a histogram read in place from the snapshot
+  explicit HistogramAccumulator(const HistogramSnapshot::View& view);
+
+  /// Destructor
+  ~HistogramAccumulator(){}
+
+  /// Add another sum, the first one added defines the binning
+  HistogramAccumulator& operator+=(const HistogramAccumulator& other);
+
+  /// Add the (clamped) contents of the histogram, the first one added defines the binning
+  HistogramAccumulator& operator+=(const TH1& histo);
+
+  /// Add the (clamped) contents of a histogram read in place from the snapshot, the first one added defines the binning
+  HistogramAccumulator& operator+=(const HistogramSnapshot::View& view);
+
+  /// Whether nothing was added yet
+  bool empty()const{return contents_.empty();}
+
+  /// Number of bins (without under- and overflow)
+  size_t nBins()const{return edges_.empty() ? 0 : edges_.size()-1;}
+
+  /// Copy bin contents and errors of all bins (without under- and overflow) into contiguous arrays
+  void binContents(std::vector<double>& content, std::vector<double>& error)const;
+
+  /// Create a histogram holding the sum, owned by the caller and not attached to any directory (NULL if empty)
+  TH1* histogram(const TString& name)const;
+
+ private:
+
+  /// Avoid empty bins in the templates
+  void clampContents();
+
+  /// Title of the first added histogram
+  std::string title_;
+
+  /// Number of entries
+  double entries_;
+
+  /// Bin edges, size number of bins + 1
+  std::vector<double> edges_;
+
+  /// Bin contents including under- and overflow, size number of bins + 2
+  std::vector<double> contents_;
+
+  /// Sums of squared weights including under- and overflow, size number of bins + 2
+  std::vector<double> sumw2_;
+};
+
+
+
+
+
+#endif
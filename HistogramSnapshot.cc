@@ -0,0 +1,219 @@
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "HistogramSnapshot.h"
+
+
+
+
+
+// File layout, all fields 8 byte words in native byte order:
+//   header:  magic, number of histograms, number of input files
+//   index:   per histogram key offset, key length, title offset, title length, number of bins, data offset, number of entries
+//   inputs:  per input file name offset, name length, modification time, size
+//   strings: keys, titles and input file names, padded to 8 bytes
+//   data:    per histogram bin edges, bin contents, sums of squared weights
+static const char snapshotMagic[8] = {'D', 'C', 'H', 'S', 'N', 'A', 'P', '2'};
+static const size_t headerWords = 3;
+static const size_t indexWords = 7;
+static const size_t inputWords = 4;
+
+
+
+HistogramSnapshot::HistogramSnapshot(const std::string& fileName):
+data_(0),
+size_(0)
+{
+  const int file = open(fileName.c_str(), O_RDONLY);
+  if(file < 0){
+    std::cerr << "Error in HistogramSnapshot! Cannot open snapshot file: " << fileName << std::endl;
+    return;
+  }
+
+  struct stat status;
+  if(fstat(file, &status) == 0 && status.st_size >= static_cast<off_t>(headerWords*sizeof(uint64_t))){
+    void* mapping = mmap(0, status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if(mapping != MAP_FAILED){
+      data_ = static_cast<const char*>(mapping);
+      size_ = status.st_size;
+    }
+  }
+  close(file);
+
+  if(!data_ || std::memcmp(data_, snapshotMagic, sizeof(snapshotMagic)) != 0){
+    std::cerr << "Error in HistogramSnapshot! Not a valid snapshot file: " << fileName << std::endl;
+    if(data_) munmap(const_cast<char*>(data_), size_);
+    data_ = 0;
+    return;
+  }
+
+  const uint64_t* header = reinterpret_cast<const uint64_t*>(data_);
+  const uint64_t numberOfHistograms = header[1];
+  const uint64_t numberOfInputFiles = header[2];
+  const uint64_t* index = header + headerWords;
+  const uint64_t* inputs = index + numberOfHistograms*indexWords;
+
+  bool ok = (headerWords + numberOfHistograms*indexWords + numberOfInputFiles*inputWords)*sizeof(uint64_t) <= size_;
+  for(uint64_t i = 0; ok && i < numberOfHistograms; ++i){
+    const uint64_t* entry = index + i*indexWords;
+    const uint64_t dataSize = (3*entry[4] + 5)*sizeof(double);
+    ok = entry[0] + entry[1] <= size_ && entry[2] + entry[3] <= size_ && entry[5] + dataSize <= size_ && entry[5]%sizeof(double) == 0;
+    if(ok) index_[std::string(data_ + entry[0], entry[1])] = i;
+  }
+  for(uint64_t i = 0; ok && i < numberOfInputFiles; ++i){
+    const uint64_t* entry = inputs + i*inputWords;
+    ok = entry[0] + entry[1] <= size_;
+    if(ok) inputFiles_[std::string(data_ + entry[0], entry[1])] = DatacardManifest::FileStamp(static_cast<int64_t>(entry[2]), entry[3]);
+  }
+
+  if(!ok){
+    std::cerr << "Error in HistogramSnapshot! Corrupt snapshot file: " << fileName << std::endl;
+    munmap(const_cast<char*>(data_), size_);
+    data_ = 0;
+    index_.clear();
+    inputFiles_.clear();
+  }
+}
+
+
+
+HistogramSnapshot::~HistogramSnapshot()
+{
+  if(data_) munmap(const_cast<char*>(data_), size_);
+}
+
+
+
+bool HistogramSnapshot::find(const std::string& fileName, const std::string& histoName, const std::string& systematic, View& view)const
+{
+  auto position = index_.find(key(fileName, histoName, systematic));
+  if(position == index_.end()) return false;
+
+  const uint64_t* entry = reinterpret_cast<const uint64_t*>(data_) + headerWords + position->second*indexWords;
+  const size_t numberOfBins = entry[4];
+  const double* values = reinterpret_cast<const double*>(data_ + entry[5]);
+
+  view.title.assign(data_ + entry[2], entry[3]);
+  std::memcpy(&view.entries, &entry[6], sizeof(double));
+  view.numberOfBins = numberOfBins;
+  view.edges = values;
+  view.contents = values + numberOfBins + 1;
+  view.sumw2 = values + 2*numberOfBins + 3;
+
+  return true;
+}
+
+
+
+std::vector<std::string> HistogramSnapshot::staleInputFiles()const
+{
+  std::vector<std::string> result;
+
+  for(const auto& inputFile : inputFiles_){
+    DatacardManifest::FileStamp stamp;
+    if(!DatacardManifest::fileStamp(inputFile.first, stamp) || stamp != inputFile.second) result.push_back(inputFile.first);
+  }
+
+  return result;
+}
+
+
+
+bool HistogramSnapshot::write(const std::string& fileName, const std::map<Key, Histogram>& histograms)
+{
+  std::vector<uint64_t> index;
+  std::string strings;
+  std::vector<double> data;
+
+  // Input files the histograms are taken from, with their current modification time and size
+  std::map<std::string, DatacardManifest::FileStamp> inputFiles;
+  for(const auto& histogram : histograms){
+    const std::string& inputFileName = std::get<0>(histogram.first);
+    if(inputFiles.count(inputFileName)) continue;
+    DatacardManifest::FileStamp& stamp = inputFiles[inputFileName];
+    if(!DatacardManifest::fileStamp(inputFileName, stamp)){
+      std::cerr << "Error in HistogramSnapshot! Cannot access input file: " << inputFileName << std::endl;
+      return false;
+    }
+  }
+
+  // Offsets are relative to the file begin, strings and data follow the index and input file tables
+  const uint64_t stringsOffset = (headerWords + histograms.size()*indexWords + inputFiles.size()*inputWords)*sizeof(uint64_t);
+
+  for(const auto& histogram : histograms){
+    const Histogram& content = histogram.second;
+    const size_t numberOfBins = content.contents.size() >= 2 ? content.contents.size() - 2 : 0;
+
+    if(content.edges.size() != numberOfBins + 1 || content.sumw2.size() != numberOfBins + 2){
+      std::cerr << "Error in HistogramSnapshot! Inconsistent bins of histogram: " << std::get<1>(histogram.first) << std::endl;
+      return false;
+    }
+
+    const std::string histogramKey = key(std::get<0>(histogram.first), std::get<1>(histogram.first), std::get<2>(histogram.first));
+    uint64_t entries;
+    std::memcpy(&entries, &content.entries, sizeof(double));
+
+    index.push_back(stringsOffset + strings.size());
+    index.push_back(histogramKey.size());
+    strings += histogramKey;
+    index.push_back(stringsOffset + strings.size());
+    index.push_back(content.title.size());
+    strings += content.title;
+    index.push_back(numberOfBins);
+    index.push_back(data.size()*sizeof(double));
+    index.push_back(entries);
+
+    data.insert(data.end(), content.edges.begin(), content.edges.end());
+    data.insert(data.end(), content.contents.begin(), content.contents.end());
+    data.insert(data.end(), content.sumw2.begin(), content.sumw2.end());
+  }
+
+  std::vector<uint64_t> inputs;
+  for(const auto& inputFile : inputFiles){
+    inputs.push_back(stringsOffset + strings.size());
+    inputs.push_back(inputFile.first.size());
+    strings += inputFile.first;
+    inputs.push_back(static_cast<uint64_t>(inputFile.second.first));
+    inputs.push_back(inputFile.second.second);
+  }
+  strings.resize((strings.size() + sizeof(double) - 1)/sizeof(double)*sizeof(double), '\0');
+
+  // Data offsets are known only now that all strings are placed
+  const uint64_t dataOffset = stringsOffset + strings.size();
+  for(size_t i = 0; i < histograms.size(); ++i) index[i*indexWords + 5] += dataOffset;
+
+  const std::string temporaryFileName(fileName+".tmp");
+  std::ofstream out(temporaryFileName.c_str(), std::ios::binary | std::ios::trunc);
+
+  const uint64_t numberOfHistograms = histograms.size();
+  const uint64_t numberOfInputFiles = inputFiles.size();
+  out.write(snapshotMagic, sizeof(snapshotMagic));
+  out.write(reinterpret_cast<const char*>(&numberOfHistograms), sizeof(numberOfHistograms));
+  out.write(reinterpret_cast<const char*>(&numberOfInputFiles), sizeof(numberOfInputFiles));
+  out.write(reinterpret_cast<const char*>(index.data()), index.size()*sizeof(uint64_t));
+  out.write(reinterpret_cast<const char*>(inputs.data()), inputs.size()*sizeof(uint64_t));
+  out.write(strings.data(), strings.size());
+  out.write(reinterpret_cast<const char*>(data.data()), data.size()*sizeof(double));
+  out.close();
+
+  if(!out || std::rename(temporaryFileName.c_str(), fileName.c_str()) != 0){
+    std::cerr << "Error in HistogramSnapshot! Cannot write snapshot file: " << fileName << std::endl;
+    std::remove(temporaryFileName.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+
+
+std::string HistogramSnapshot::key(const std::string& fileName, const std::string& histoName, const std::string& systematic)
+{
+  return fileName + '\0' + histoName + '\0' + systematic;
+}
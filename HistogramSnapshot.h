@@ -0,0 +1,122 @@
+#ifndef HistogramSnapshot_h
+#define HistogramSnapshot_h
+
+#include <map>
+#include <vector>
+#include <string>
+#include <utility>
+#include <tuple>
+#include <unordered_map>
+#include <cstdint>
+
+#include "DatacardManifest.h"
+
+
+
+
+
+/// Compact snapshot of the input histograms of the datacard maker, independent of ROOT I/O
+/// The snapshot is a flat binary file holding, per (input file, histogram name, systematic), the bin edges, the bin contents
+/// and the sums of squared weights (both including under- and overflow), which is memory-mapped for reading,
+/// so that the histogram data are accessed in place without any deserialization
+/// The histogram name follows the input convention <mva config>_<process>, identifying event category and process,
+/// the input file identifies the channel
+/// The modification time and size of each input file are recorded, to detect snapshots outdated by changed inputs
+class HistogramSnapshot{
+
+ public:
+
+  /// Histogram content to be written to a snapshot
+  struct Histogram{
+
+    /// Constructor
+    Histogram():entries(0.){}
+
+    /// Histogram title
+    std::string title;
+
+    /// Number of entries
+    double entries;
+
+    /// Bin edges, size number of bins + 1
+    std::vector<double> edges;
+
+    /// Bin contents including under- and overflow, size number of bins + 2
+    std::vector<double> contents;
+
+    /// Sums of squared weights including under- and overflow, size number of bins + 2
+    std::vector<double> sumw2;
+  };
+
+  /// Read-only view of a histogram in the memory-mapped snapshot, valid for the lifetime of the snapshot
+  struct View{
+
+    /// Histogram title
+    std::string title;
+
+    /// Number of entries
+    double entries;
+
+    /// Number of bins (without under- and overflow)
+    size_t numberOfBins;
+
+    /// Bin edges, size number of bins + 1
+    const double* edges;
+
+    /// Bin contents including under- and overflow, size number of bins + 2
+    const double* contents;
+
+    /// Sums of squared weights including under- and overflow, size number of bins + 2
+    const double* sumw2;
+  };
+
+  /// Key of a histogram: input file name, histogram name, systematic
+  typedef std::tuple<std::string, std::string, std::string> Key;
+
+  /// Constructor, memory-mapping the snapshot file
+  explicit HistogramSnapshot(const std::string& fileName);
+
+  /// Destructor, releasing the mapping
+  ~HistogramSnapshot();
+
+  /// Whether the snapshot could not be read
+  bool isZombie()const{return data_ == 0;}
+
+  /// Number of histograms in the snapshot
+  size_t size()const{return index_.size();}
+
+  /// Access histogram of given input file, name and systematic, returns false if it is not in the snapshot
+  bool find(const std::string& fileName, const std::string& histoName, const std::string& systematic, View& view)const;
+
+  /// Input files whose modification time or size changed since the snapshot was written (or which do not exist anymore)
+  std::vector<std::string> staleInputFiles()const;
+
+  /// Write the histograms, by (input file, histogram name, systematic), to a snapshot file, returns false if writing failed
+  static bool write(const std::string& fileName, const std::map<Key, Histogram>& histograms);
+
+ private:
+
+  HistogramSnapshot(const HistogramSnapshot&) = delete;
+  HistogramSnapshot& operator=(const HistogramSnapshot&) = delete;
+
+  /// Key of a histogram in the snapshot
+  static std::string key(const std::string& fileName, const std::string& histoName, const std::string& systematic);
+
+  /// Memory-mapped snapshot file
+  const char* data_;
+
+  /// Size of the mapping
+  size_t size_;
+
+  /// Position in the index table of the snapshot, by key
+  std::unordered_map<std::string, size_t> index_;
+
+  /// Input files the snapshot was written from, with their modification time and size at that time
+  std::map<std::string, DatacardManifest::FileStamp> inputFiles_;
+};
+
+
+
+
+
+#endif
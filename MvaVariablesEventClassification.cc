@@ -1,14 +1,12 @@
 #include <vector>
 #include <algorithm>
+#include <cmath>
 #include <iterator>
+#include <atomic>
 
 #include <TMath.h>
-#include <TVector.h>
-#include <TVectorD.h>
-#include <TVector3.h>
+#include <TROOT.h>
 #include <TLorentzVector.h>
-#include <TMatrixDSym.h>
-#include <Math/Vector3D.h>
 #include <Math/VectorUtil.h>
 
 #include "MvaVariablesEventClassification.h"
@@ -21,6 +19,7 @@
 #include "MvaReaderTopJets.h"
 #include "MvaVariablesTopJets.h"
 #include "higgsUtils.h"
+#include "ThreadPool.h"
 #include "analysisStructs.h"
 
 
@@ -416,6 +415,10 @@ MvaVariablesEventClassification:: TopPairVariable:: TopPairVariable(std::string
     topSystemWeight_->book(weight_topSystemBDT_);
 }
 
+MvaVariablesEventClassification:: TopPairVariable:: ~TopPairVariable(){
+    delete topSystemWeight_;
+}
+
 std::pair<int,int> MvaVariablesEventClassification::TopPairVariable::jetPairsFromMVA(const EventMetadata& eventMetadata,
                                                                                        const tth::RecoObjectIndices& recoObjectIndices,
                                                                                        const tth::GenObjectIndices& genObjectIndices,
@@ -449,67 +452,70 @@ std::pair<int,int> MvaVariablesEventClassification::TopPairVariable::jetPairsFro
    return topPair;
 }
 
-MvaVariablesEventClassification* MvaVariablesEventClassification::fillVariables(const EventMetadata& eventMetadata,
-                                                                                const tth::RecoObjectIndices& recoObjectIndices,
-                                                                                const RecoObjects& recoObjects,
-                                                                                const tth::GenObjectIndices& genObjectIndices,
-                                                                                const double& eventWeight)
+void MvaVariablesEventClassification::computeVariables(const EventMetadata& eventMetadata,
+                                                       const tth::RecoObjectIndices& recoObjectIndices,
+                                                       const RecoObjects& recoObjects,
+                                                       const tth::GenObjectIndices& genObjectIndices,
+                                                       const double& eventWeight,
+                                                       double* values)
 {
-    using ROOT::Math::VectorUtil::DeltaR;
-    
     // Access relevant objects and indices
     const std::vector<double>& jetBtags(*recoObjects.jetBtags_);
     const VLV& leptons(*recoObjects.allLeptons_);
     const VLV& jets(*recoObjects.jets_);
-    
-    // Identify the most likely pair to stem from tt 
+
+    // Identify the most likely pair to stem from tt
     std::pair<int,int> topPair;
-    
-    std::string weight_topSystemBDT = "/nfs/dust/cms/user/chrisjcc/Variables2/Area1/analysisArea/xmlWeights/correct_step7_cate5_cate6_cate7_c1.weights.xml"; 
-    
-    if(recoObjectIndices.jetIndices_.size()>1) topPair = TopPairVariable::Instance(weight_topSystemBDT).jetPairsFromMVA(eventMetadata, recoObjectIndices, genObjectIndices, recoObjects, eventWeight); 
-    
+
+    static const std::string weight_topSystemBDT = "/nfs/dust/cms/user/chrisjcc/Variables2/Area1/analysisArea/xmlWeights/correct_step7_cate5_cate6_cate7_c1.weights.xml";
+
+    if(recoObjectIndices.jetIndices_.size()>1) topPair = TopPairVariable::Instance(weight_topSystemBDT).jetPairsFromMVA(eventMetadata, recoObjectIndices, genObjectIndices, recoObjects, eventWeight);
+
+    // Gather the selected jets once, together with the quantities of all jet pairs, in storage reused by each thread
+    static thread_local JetKinematics kinematics;
+    kinematics.fill(jets, recoObjectIndices.jetIndices_, recoObjectIndices.bjetIndices_);
+
     // Calculate several jet-dependent quantities
+    // Calculate the btag-discriminator averages, setting values<0. to 0.
+    // Avoid b-tag values where the algorithm did not work, giving values>1., setting them to 1.
+    auto btagDiscriminatorInRange = [&](const int position){
+        const double& btagDiscriminator(jetBtags.at(recoObjectIndices.jetIndices_.at(position)));
+        const double btagDiscriminatorPositive(btagDiscriminator>=0. ? btagDiscriminator : 0.);
+        return btagDiscriminatorPositive<=1. ? btagDiscriminatorPositive : 1.;
+    };
     double btagDiscriminatorSumTagged(0.);
+    double sumTagPt(0.);
+    double sumTagE(0.);
+    for(const int position : kinematics.taggedPositions_){
+        btagDiscriminatorSumTagged += btagDiscriminatorInRange(position);
+        sumTagPt += kinematics.pt_[position];
+        sumTagE += kinematics.energy_[position];
+    }
     double btagDiscriminatorSumUntagged(0.);
-    double minDeltaRJetJet(999.);
-    double ptSumJets(0.);
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-        // Calculate the btag-discriminator averages, setting values<0. to 0.
-        const double& btagDiscriminator(jetBtags.at(*i_index));
-        const double btagDiscriminatorPositive(btagDiscriminator>=0. ? btagDiscriminator : 0.);
-        // Avoid b-tag values where the algorithm did not work, giving values>1., setting them to 1.
-        const double btagDiscriminatorInRange(btagDiscriminatorPositive<=1. ? btagDiscriminatorPositive : 1.);
-        if(std::find(recoObjectIndices.bjetIndices_.begin(), recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()){
-            btagDiscriminatorSumTagged += btagDiscriminatorInRange;
-        }
-        else{
-            btagDiscriminatorSumUntagged += btagDiscriminatorInRange;
-        }
-        
-        // Minimum deltaR between jets
-        for(auto j_index = i_index+1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-            const double deltaR = DeltaR(jets.at(*i_index), jets.at(*j_index));
-            if(deltaR < minDeltaRJetJet) minDeltaRJetJet = deltaR;
-        }
-        
-        // Scalar sum of pt of all jets
-        ptSumJets += jets.at(*i_index).pt();
+    for(const int position : kinematics.untaggedPositions_){
+        btagDiscriminatorSumUntagged += btagDiscriminatorInRange(position);
+    }
+
+    // Scalar sums of pt and energy of all jets
+    double sumJetPt(0.);
+    double sumJetE(0.);
+    for(size_t iJet = 0; iJet < kinematics.size(); ++iJet){
+        sumJetPt += kinematics.pt_[iJet];
+        sumJetE += kinematics.energy_[iJet];
     }
     const int numberOfJets(recoObjectIndices.jetIndices_.size());
     const int numberOfTaggedJets(recoObjectIndices.bjetIndices_.size());
     const int numberOfUntaggedJets(numberOfJets - numberOfTaggedJets);
     const double btagDiscriminatorAverage_tagged = numberOfTaggedJets>0 ? btagDiscriminatorSumTagged/static_cast<double>(numberOfTaggedJets) : 0.;
     const double btagDiscriminatorAverage_untagged = numberOfUntaggedJets>0 ? btagDiscriminatorSumUntagged/static_cast<double>(numberOfUntaggedJets) : 0.;
-    const double ptSumJetsLeptons = ptSumJets + leptons.at(recoObjectIndices.leptonIndex_).pt() + leptons.at(recoObjectIndices.antiLeptonIndex_).pt();
-    
+    const double ptSumJetsLeptons = sumJetPt + leptons.at(recoObjectIndices.leptonIndex_).pt() + leptons.at(recoObjectIndices.antiLeptonIndex_).pt();
+
     // Calculate several dijet dependent quantities
     int numberOfHiggsLikeDijet15(0);
     double higgsLikeDijetMass(-999.);
     double higgsLikeDijetMass2(-999.);
     for(const auto& indexPair : recoObjectIndices.jetIndexPairs_){
-        const bool hasBtag = (std::find(recoObjectIndices.bjetIndices_.begin(), recoObjectIndices.bjetIndices_.end(), indexPair.first) != recoObjectIndices.bjetIndices_.end()) || 
-                             (std::find(recoObjectIndices.bjetIndices_.begin(), recoObjectIndices.bjetIndices_.end(), indexPair.second) != recoObjectIndices.bjetIndices_.end());
+        const bool hasBtag = kinematics.isTaggedJet_.at(indexPair.first) || kinematics.isTaggedJet_.at(indexPair.second);
         constexpr double higgsMass(125.);
         const double dijetMass = (jets.at(indexPair.first) + jets.at(indexPair.second)).M();
         if(std::abs(higgsMass - dijetMass) < std::abs(higgsMass - higgsLikeDijetMass)) higgsLikeDijetMass = dijetMass;
@@ -518,605 +524,165 @@ MvaVariablesEventClassification* MvaVariablesEventClassification::fillVariables(
             if(std::abs(dijetMass - higgsMass) < 15.) ++numberOfHiggsLikeDijet15;
         }
     }
-    
-
-    // Calculate several new jet-dependent quantities                                                                                                                          
-    double minDeltaRTagTag(999.);
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV tag1;
-
-      if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()){
-        tag1      = jets.at(*i_index);
-      }
-      else
-        continue;
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        LV tag2;
-
-        if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *j_index) != recoObjectIndices.bjetIndices_.end()){
-          tag2      = jets.at(*j_index);
-        }
-        else
-          continue;
-
-        const double deltaR = DeltaR(tag1, tag2);
-
-        if(deltaR < minDeltaRTagTag) {
-          minDeltaRTagTag = deltaR;
-        }
-      }
-    }
-    
-    std::vector<double> deltaRjetjetCollection;
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV jet1  = jets.at(*i_index);
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        LV jet2 = jets.at(*j_index);
-
-        const double deltaR = DeltaR(jet1, jet2);
-
-        deltaRjetjetCollection.push_back(deltaR);
-      }
-    }
-    double sumDeltaR_jet_jet = std::accumulate(std::begin(deltaRjetjetCollection), std::end(deltaRjetjetCollection), 0.0);
-    double avgDeltaRJetJet =  sumDeltaR_jet_jet/deltaRjetjetCollection.size();
-
-    std::vector<double> deltaRjettagCollection;
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-
-      LV jet;
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        LV tag;
-
-        if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *j_index) != recoObjectIndices.bjetIndices_.end()
-           || std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()){
-          jet      = jets.at(*i_index);
-          tag      = jets.at(*j_index);
-        }
-        else
-          continue;
-        const double deltaR = DeltaR(jet, tag);
-        deltaRjettagCollection.push_back(deltaR);
-      }
-    }
-    double sumDeltaR_jet_tag = std::accumulate(std::begin(deltaRjettagCollection), std::end(deltaRjettagCollection), 0.0);
-    double avgDeltaRJetTag =  sumDeltaR_jet_tag/deltaRjettagCollection.size();
-
-    std::vector<double> deltaRtagtagCollection;
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV tag1;
-
-      if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()){
-        tag1      = jets.at(*i_index);
-      }
-      else
-        continue;
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        LV tag2;
-
-        if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *j_index) != recoObjectIndices.bjetIndices_.end()){
-          tag2      = jets.at(*j_index);
-        }
-        else
-          continue;
 
-        const double deltaR = DeltaR(tag1, tag2);
 
-        deltaRtagtagCollection.push_back(deltaR);
-      }
-    }
-    double sumDeltaR_tag_tag = std::accumulate(std::begin(deltaRtagtagCollection), std::end(deltaRtagtagCollection), 0.0);
-    double avgDeltaRTagTag =  sumDeltaR_tag_tag/deltaRtagtagCollection.size();
+    // Calculate all jet pair quantities in a single pass over the pairs,
+    // jet-tag pairs are those with at least one b-tagged jet, tag-tag pairs those with two (iterated over the b-tagged jets only)
+    double minDeltaRJetJet(999.);
+    double minDeltaRJetTag(999.);
+    double minDeltaRTagTag(999.);
+    double pT_jet_jet_min_deltaR(-999.);
+    double pT_jet_tag_min_deltaR(-999.);
+    double pT_tag_tag_min_deltaR(-999.);
+    double mass_jet_jet_min_deltaR(-999.);
+    double mass_jet_tag_min_deltaR(-999.);
+    double mass_tag_tag_min_deltaR(-999.);
+    double twist_tag_tag_min_deltaR(-999.);
 
+    double sumDeltaRJetJet(0.);
+    double sumDeltaRJetTag(0.);
+    double sumDeltaRTagTag(0.);
+    size_t numberOfJetTagPairs(0);
+    size_t numberOfTagTagPairs(0);
 
     double maxDeltaEta_jet_jet(-999.);
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV jet1 = jets.at(*i_index);
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        LV jet2  = jets.at(*j_index);
-
-        const double DeltaEta = fabs(jet1.Eta() - jet2.Eta());
-
-        if(DeltaEta > maxDeltaEta_jet_jet) {
-          maxDeltaEta_jet_jet = DeltaEta;
-        }
-      }
-    }
-    
     double maxDeltaEta_tag_tag(-999.);
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV tag1;
-
-      if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()){
-        tag1      = jets.at(*i_index);
-      }
-      else
-        continue;
+    double mass_tag_tag_max_mass(-999.);
 
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        LV tag2;
+    // Twist of the pair with maximum mass, only pairs of positive mass are considered
+    double max_mass_jet_jet(0.);
+    double max_mass_jet_tag(0.);
+    double max_mass_tag_tag(0.);
+    double twist_jet_jet_max_mass(-999.);
+    double twist_jet_tag_max_mass(-999.);
+    double twist_tag_tag_max_mass(-999.);
 
-        if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *j_index) != recoObjectIndices.bjetIndices_.end()){
-          tag2      = jets.at(*j_index);
+    std::pair<int, int> p_mass_jj(-999,-999);
+    int i_index_maxCSV(-999);
+    int j_index_maxCSV(-999);
+    const double maxCSV1(-999.);
+    const double maxCSV2(-999.);
+
+    for(size_t iPair = 0; iPair < kinematics.numberOfPairs(); ++iPair){
+        const int iJet = kinematics.first_[iPair];
+        const int jJet = kinematics.second_[iPair];
+        const double deltaR = kinematics.deltaR_[iPair];
+        const double deltaEta = std::fabs(kinematics.deltaEta_[iPair]);
+        const double mass = kinematics.mass_[iPair];
+
+        sumDeltaRJetJet += deltaR;
+        if(deltaR < minDeltaRJetJet){
+            minDeltaRJetJet = deltaR;
+            pT_jet_jet_min_deltaR = kinematics.ptPair_[iPair];
+            mass_jet_jet_min_deltaR = mass;
         }
-        else
-          continue;
-
-        const double DeltaEta = fabs(tag1.Eta() - tag2.Eta());
-
-        if(DeltaEta > maxDeltaEta_tag_tag) {
-          maxDeltaEta_tag_tag = DeltaEta;
+        if(deltaEta > maxDeltaEta_jet_jet) maxDeltaEta_jet_jet = deltaEta;
+        if(mass > max_mass_jet_jet){
+            max_mass_jet_jet = mass;
+            twist_jet_jet_max_mass = kinematics.twist(iPair);
         }
-      }
-    }
-
-
-    double sumJetPt(0.);
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV jet = jets.at(*i_index);
-      sumJetPt += jet.pt();
-    }
 
-
-    double sumTagPt(0.);
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV tag;
-
-      if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()){
-        tag      = jets.at(*i_index);
-      }
-      else
-        continue;
-      sumTagPt += tag.pt();
-    }
-
-
-    double minDeltaRjetjet(999.);
-    double pT_jet_jet_min_deltaR(-999.);
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV jet1 = jets.at(*i_index);
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        LV jet2 = jets.at(*j_index);
-
-        const double deltaR = DeltaR(jet1, jet2);
-
-        if(deltaR < minDeltaRjetjet) {
-          minDeltaRjetjet = deltaR;
-          //pT_jet_jet_min_deltaR = fabs(jet1.pt() + jet2.pt());                                                                                              
-          pT_jet_jet_min_deltaR = (jet1 + jet2).pt();
-        }
-      }
-    }
-
-
-    double minDeltaRjettag(999.);
-    double pT_jet_tag_min_deltaR(-999.);
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV jet;
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        LV tag;
-
-        if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *j_index) != recoObjectIndices.bjetIndices_.end()
-           || std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()){
-          jet = jets.at(*i_index);
-          tag      = jets.at(*j_index);
+        if(kinematics.tagged_[iJet] || kinematics.tagged_[jJet]){
+            sumDeltaRJetTag += deltaR;
+            ++numberOfJetTagPairs;
+            if(deltaR < minDeltaRJetTag){
+                minDeltaRJetTag = deltaR;
+                pT_jet_tag_min_deltaR = kinematics.ptPair_[iPair];
+                mass_jet_tag_min_deltaR = mass;
+            }
+            if(mass > max_mass_jet_tag){
+                max_mass_jet_tag = mass;
+                twist_jet_tag_max_mass = kinematics.twist(iPair);
+            }
         }
-        else
-          continue;
 
-        const double deltaR = DeltaR(jet, tag);
+        // Veto jet if it's been tagged as most likely coming from the top-antitop system
+        const int index1 = recoObjectIndices.jetIndices_[iJet];
+        const int index2 = recoObjectIndices.jetIndices_[jJet];
+        if(index1 == topPair.first || index1 == topPair.second || index2 == topPair.first || index2 == topPair.second) continue;
+        if(jetBtags.at(index1) > maxCSV1) i_index_maxCSV = index1;
+        if(jetBtags.at(index2) > maxCSV2) j_index_maxCSV = index2;
+        p_mass_jj = std::make_pair(i_index_maxCSV, j_index_maxCSV);
+    }
 
-        if(deltaR < minDeltaRjettag) {
-          minDeltaRjettag = deltaR;
-          //pTjettag_min_deltaR = fabs(jet.pt() + tag.pt());                                                                                                  
-          pT_jet_tag_min_deltaR = (jet + tag).pt();
+    // Tag-tag pairs, from the pairs of b-tagged jets only
+    for(auto i_tag = kinematics.taggedPositions_.begin(); i_tag != kinematics.taggedPositions_.end(); ++i_tag){
+        for(auto j_tag = i_tag + 1; j_tag != kinematics.taggedPositions_.end(); ++j_tag){
+            const size_t iPair = kinematics.pair(*i_tag, *j_tag);
+            const double deltaR = kinematics.deltaR_[iPair];
+            const double deltaEta = std::fabs(kinematics.deltaEta_[iPair]);
+            const double mass = kinematics.mass_[iPair];
+
+            sumDeltaRTagTag += deltaR;
+            ++numberOfTagTagPairs;
+            if(deltaR < minDeltaRTagTag){
+                minDeltaRTagTag = deltaR;
+                pT_tag_tag_min_deltaR = kinematics.ptPair_[iPair];
+                mass_tag_tag_min_deltaR = mass;
+                twist_tag_tag_min_deltaR = kinematics.twist(iPair);
+            }
+            if(deltaEta > maxDeltaEta_tag_tag) maxDeltaEta_tag_tag = deltaEta;
+            if(mass > mass_tag_tag_max_mass) mass_tag_tag_max_mass = mass;
+            if(mass > max_mass_tag_tag){
+                max_mass_tag_tag = mass;
+                twist_tag_tag_max_mass = kinematics.twist(iPair);
+            }
         }
-      }
     }
 
+    const double avgDeltaRJetJet = sumDeltaRJetJet/static_cast<double>(kinematics.numberOfPairs());
+    const double avgDeltaRJetTag = sumDeltaRJetTag/static_cast<double>(numberOfJetTagPairs);
+    const double avgDeltaRTagTag = sumDeltaRTagTag/static_cast<double>(numberOfTagTagPairs);
 
-    double minDeltaRtagtag(999.);
-    double pT_tag_tag_min_deltaR(-999.);
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV tag1;
-
-      if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()){
-        tag1      = jets.at(*i_index);
-      }
-      else
-        continue;
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        LV tag2;
-
-        if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *j_index) != recoObjectIndices.bjetIndices_.end()){
-          tag2      = jets.at(*j_index);
-        }
-        else
-          continue;
-
-        const double deltaR = DeltaR(tag1, tag2);
+    double median_mass_jet_jet(-999.);
+    if(kinematics.numberOfPairs() != 0) median_mass_jet_jet = kinematics.medianMass();
 
-        if(deltaR < minDeltaRtagtag) {
-          minDeltaRtagtag = deltaR;
-          //pT_tag_tag_min_deltaR = fabs(tag1.pt() + tag2.pt());                                                                                              
-          pT_tag_tag_min_deltaR = (tag1 + tag2).pt();
-        }
-      }
-    }
+    const double mass_jj = (p_mass_jj != std::make_pair(-999,-999)) ? (jets.at(p_mass_jj.first) + jets.at(p_mass_jj.second)).M() : -999.;
 
 
+    // Three-jet system with maximum pt, for all jet triplets and those with at least two b-tagged jets
     double mass_jet_jet_jet_max_pT(-999.);
     double max_sum_jet_pT(-999.);
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV jet1  = jets.at(*i_index);
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        LV jet2  = jets.at(*j_index);
-
-        for(auto k_index = j_index + 1; k_index != recoObjectIndices.jetIndices_.end(); ++k_index){
-
-          LV jet3  = jets.at(*k_index);
-
-          //double sum_jet_pT = jet1.pt()+jet2.pt()+jet3.pt();                                                                                                
-          double sum_jet_pT = (jet1+jet2+jet3).pt();
-
-          if(sum_jet_pT > max_sum_jet_pT) {
-            max_sum_jet_pT = sum_jet_pT;
-            mass_jet_jet_jet_max_pT = (jet1+jet2+jet3).M();
-          }
-        }
-      }
-    }
-
-
     double mass_jet_tag_tag_max_pT(-999.);
     double max_sum_tag_pT(-999.);
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV jet1;
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        LV jet2;
-
-        for(auto k_index = j_index + 1; k_index != recoObjectIndices.jetIndices_.end(); ++k_index){
-          LV jet3;
-
-          if((std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()
-              && std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *j_index) != recoObjectIndices.bjetIndices_.end())
-             || (std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()
-                 && std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *k_index) != recoObjectIndices.bjetIndices_.end())
-             || (std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *j_index) != recoObjectIndices.bjetIndices_.end()
-                 && std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *k_index) != recoObjectIndices.bjetIndices_.end()))
-            {
-              jet1     = jets.at(*i_index);
-              jet2     = jets.at(*j_index);
-              jet3     = jets.at(*k_index);
+    for(size_t iJet = 0; iJet < kinematics.size(); ++iJet){
+        for(size_t jJet = iJet + 1; jJet < kinematics.size(); ++jJet){
+            const int numberOfTagsInPair = kinematics.tagged_[iJet] + kinematics.tagged_[jJet];
+            for(size_t kJet = jJet + 1; kJet < kinematics.size(); ++kJet){
+                const double px = kinematics.px_[iJet] + kinematics.px_[jJet] + kinematics.px_[kJet];
+                const double py = kinematics.py_[iJet] + kinematics.py_[jJet] + kinematics.py_[kJet];
+                const double pt = std::sqrt(px*px + py*py);
+                const bool twoTags = numberOfTagsInPair + kinematics.tagged_[kJet] >= 2;
+                if(pt <= max_sum_jet_pT && (!twoTags || pt <= max_sum_tag_pT)) continue;
+
+                const double pz = kinematics.pz_[iJet] + kinematics.pz_[jJet] + kinematics.pz_[kJet];
+                const double energy = kinematics.energy_[iJet] + kinematics.energy_[jJet] + kinematics.energy_[kJet];
+                const double mass = JetKinematics::mass(px, py, pz, energy);
+                if(pt > max_sum_jet_pT){
+                    max_sum_jet_pT = pt;
+                    mass_jet_jet_jet_max_pT = mass;
+                }
+                if(twoTags && pt > max_sum_tag_pT){
+                    max_sum_tag_pT = pt;
+                    mass_jet_tag_tag_max_pT = mass;
+                }
             }
-          else
-            continue;
-
-          //double sum_tag_pT = jet1.pt()+jet2.pt()+jet3.pt();                                                                                                
-          double sum_tag_pT = (jet1+jet2+jet3).pt();
-
-          if(sum_tag_pT > max_sum_tag_pT) {
-            max_sum_tag_pT = sum_tag_pT;
-            mass_jet_tag_tag_max_pT = (jet1+jet2+jet3).M();
-          }
-        }
-      }
-    }
-
-    
-    double mass_jet_jet_min_deltaR(-999.);
-    double minDeltaR_JetJet(999.);
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV jet1 = jets.at(*i_index);
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        LV jet2 = jets.at(*j_index);
-
-        const double deltaR = DeltaR(jet1, jet2);
-
-        if(deltaR < minDeltaR_JetJet) {
-          minDeltaR_JetJet = deltaR;
-          mass_jet_jet_min_deltaR = (jet1+jet2).M();
-        }
-      }
-    }
-
-    
-
-    double mass_jet_tag_min_deltaR(-999.);
-    double minDeltaR_JetTag(999.);
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV jet;
-      LV tag;
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        //  LV tag;
-
-        if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()
-           || std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *j_index) != recoObjectIndices.bjetIndices_.end()){
-
-          jet      = jets.at(*i_index);
-          tag      = jets.at(*j_index);
-        }
-        else
-          continue;
-      
-        const double deltaR = DeltaR(jet, tag);
-        
-        if(deltaR < minDeltaR_JetTag) {
-          minDeltaR_JetTag = deltaR;
-          mass_jet_tag_min_deltaR = (jet+tag).M();
         }
-      }
-    }
-   
-    
-    double mass_tag_tag_min_deltaR(-999.);
-    double minDeltaR_TagTag(999.);
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV tag1;
-      
-      if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()){
-        tag1      = jets.at(*i_index);
-      }
-      else
-        continue;
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        LV tag2;
-
-        if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *j_index) != recoObjectIndices.bjetIndices_.end()){
-          tag2      = jets.at(*j_index);
-        }
-        else
-          continue;
-
-        const double deltaR = DeltaR(tag1, tag2);
-
-        if(deltaR < minDeltaR_TagTag) {
-          minDeltaR_TagTag = deltaR;
-          mass_tag_tag_min_deltaR = (tag1+tag2).M();
-        }
-      }
-    }
-    
-
-
-    double mass_tag_tag_max_mass(-999.);
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV tag1;
-
-      if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()){
-        tag1      = jets.at(*i_index);
-      }
-      else
-        continue;
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        LV tag2;
-
-        if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *j_index) != recoObjectIndices.bjetIndices_.end()){
-          tag2      = jets.at(*j_index);
-        }
-        else
-          continue;
-
-        const double mass = (tag1+tag2).M();
-
-        if(mass > mass_tag_tag_max_mass) {
-          mass_tag_tag_max_mass = mass;
-        }
-      }
-    }
-
-
-    double median_mass_jet_jet(-999.);
-    std::vector<double> massJetJetCollection;
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-
-      LV jet1 = jets.at(*i_index);
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-
-        LV jet2 = jets.at(*j_index);
-
-        const double mass = (jet1 + jet2).M();
-
-        massJetJetCollection.push_back(mass);
-      }
-    }
-
-    std::sort(massJetJetCollection.begin(),massJetJetCollection.end());
-    size_t n = massJetJetCollection.size();
-
-    if (n != 0) {
-
-      if((int)n%2 == 0)
-        median_mass_jet_jet = (massJetJetCollection.at(n/2) + massJetJetCollection.at(n/2-1))/2;
-      else
-        median_mass_jet_jet = massJetJetCollection.at((n-1)/2);
     }
 
 
-
-
     // Centrality calculations
-    double centrality_jets_leps(-999.);
-    double centrality_tags(-999.0);
-    double sumJetPT(.0);
-    double sumJetE(.0);
-    double sumTagPT(.0);
-    double sumTagE(.0);    
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){                                   
-      
-      LV jet = jets.at(*i_index); 
-      sumJetPT += jet.pt();
-      sumJetE += jet.E();
-      
-      if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()){         
-        sumTagPT += jet.pt();
-        sumTagE += jet.E();
-      }
-    }
-
     LV lepton = leptons.at(recoObjectIndices.leptonIndex_);
     LV antilepton = leptons.at(recoObjectIndices.antiLeptonIndex_);
 
-    centrality_jets_leps = (sumJetPT + lepton.pt() + antilepton.pt())/(sumJetE + lepton.E() + antilepton.E());
-    centrality_tags = sumTagPT/sumTagE;
-
-
-
-    // Twist between jet pair 
-    double max_mass_jet_jet(0.);
-    double twist_jet_jet_max_mass(-999.);
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      
-      LV jet1 = jets.at(*i_index);
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-
-        LV jet2 = jets.at(*j_index); 
-
-        const double mass = (jet1 + jet2).M();
-
-        if(mass > max_mass_jet_jet) {
-          max_mass_jet_jet = mass;
-          twist_jet_jet_max_mass = TMath::ATan(ROOT::Math::VectorUtil::DeltaPhi(jet1, jet2)/(jet1.Eta() - jet2.Eta()));
-        }
-        
-      }
-    }
-
-
-    // Twist between jet and b-tagged jet pair
-    double max_mass_jet_tag(0.);
-    double twist_jet_tag_max_mass(-999.);
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-
-      LV jet1;
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-
-        LV jet2;
-
-        if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *j_index) != recoObjectIndices.bjetIndices_.end()
-           || std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()){
-
-          jet1 = jets.at(*i_index);
-          jet2 = jets.at(*j_index);
-
-          const double mass = (jet1 + jet2).M();
-
-          if(mass > max_mass_jet_tag) {
-            max_mass_jet_tag = mass;
-            twist_jet_tag_max_mass = TMath::ATan(ROOT::Math::VectorUtil::DeltaPhi(jet1, jet2)/(jet1.Eta() - jet2.Eta()));
-          }
-
-        }
-      }
-    }
-
-
-    // Twist between b-tagged jet pair 
-    double max_mass_tag_tag(0.);
-    double twist_tag_tag_max_mass(-999.);
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        
-        LV tag1;
-        LV tag2;
-        
-        if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()){
-              
-          if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *j_index) != recoObjectIndices.bjetIndices_.end()){
-                    
-            tag1 = jets.at(*i_index);
-            tag2 = jets.at(*j_index);
-                    
-            const double mass = (tag1 + tag2).M();
-
-            if(mass > max_mass_tag_tag) {
-              max_mass_tag_tag = mass;
-              twist_tag_tag_max_mass = TMath::ATan(ROOT::Math::VectorUtil::DeltaPhi(tag1, tag2)/(tag1.Eta() - tag2.Eta()));
-            }
-                    
-          }  
-        }
-      }
-    }
-
-
-    // Twist between b-tagged jet pair 
-    double min_deltaR_tag_tag(999.);
-    double twist_tag_tag_min_deltaR(-999.);
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        
-        LV tag1;
-        LV tag2;
-        
-        if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()){
-            
-          if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *j_index) != recoObjectIndices.bjetIndices_.end()){
-                
-            tag1 = jets.at(*i_index);
-            tag2 = jets.at(*j_index);
-                
-            const double deltaR = DeltaR(tag1, tag2);
-                
-            if(deltaR < min_deltaR_tag_tag) {
-              min_deltaR_tag_tag = deltaR;
-              twist_tag_tag_min_deltaR = TMath::ATan(ROOT::Math::VectorUtil::DeltaPhi(tag1, tag2)/(tag1.Eta() - tag2.Eta()));
-            }
-
-          }  
-        }
-      }
-    }
+    const double centrality_jets_leps = (sumJetPt + lepton.pt() + antilepton.pt())/(sumJetE + lepton.E() + antilepton.E());
+    const double centrality_tags = sumTagPt/sumTagE;
 
 
     // Event shape variable for jets in the event
-    std::vector<LV> recoJetCollection;
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV jet = jets.at(*i_index);
+    EventShapeVariables eventshape_jets(jets, recoObjectIndices.jetIndices_);
 
-      recoJetCollection.push_back(jet);
-    }
-   
-    EventShapeVariables eventshape_jets(recoJetCollection);
-    
-    // Spherecity eigenvalue varaibles jets 
+    // Spherecity eigenvalue varaibles jets
     double sphericity_jet  = eventshape_jets.sphericity();
     double aplanarity_jet  = eventshape_jets.aplanarity();
     double circularity_jet = eventshape_jets.circularity();
@@ -1137,26 +703,11 @@ MvaVariablesEventClassification* MvaVariablesEventClassification::fillVariables(
     double R3_jet = eventshape_jets.R(3);
     double R4_jet = eventshape_jets.R(4);
 
- 
-    // Event shape variables for b-tag jets in the event
-    std::vector<LV> recoBJetCollection;
-
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      LV tag;
-
-      // Select b-tagged jets
-      if(std::find(recoObjectIndices.bjetIndices_.begin(),recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end()){
-        tag  = jets.at(*i_index);
-      }
-      else
-        continue;
-
-      recoBJetCollection.push_back(tag);
-    }
 
-    EventShapeVariables eventshape_tags(recoBJetCollection);        
+    // Event shape variables for b-tag jets in the event
+    EventShapeVariables eventshape_tags(jets, kinematics.taggedIndices_);
 
-    // Sphericity associated variables 
+    // Sphericity associated variables
     double sphericity_tag  = eventshape_tags.sphericity();
     double aplanarity_tag  = eventshape_tags.aplanarity();
     double circularity_tag = eventshape_tags.circularity();
@@ -1178,69 +729,217 @@ MvaVariablesEventClassification* MvaVariablesEventClassification::fillVariables(
     double R4_tag = eventshape_tags.R(4);
 
 
-    std::pair<int, int> p_mass_jj(-999,-999);
-    double mass_jj(-999.);
+    // Fill the variables, indexed as in the columnar buffer
+    values[ColumnBuffer::multiplicity_jets] = numberOfJets;
+    values[ColumnBuffer::btagDiscriminatorAverage_tagged] = btagDiscriminatorAverage_tagged;
+    values[ColumnBuffer::btagDiscriminatorAverage_untagged] = btagDiscriminatorAverage_untagged;
+    values[ColumnBuffer::minDeltaR_jet_jet] = minDeltaRJetJet;
+    values[ColumnBuffer::minDeltaR_tag_tag] = minDeltaRTagTag;
+    values[ColumnBuffer::avgDeltaR_jet_jet] = avgDeltaRJetJet;
+    values[ColumnBuffer::avgDeltaR_jet_tag] = avgDeltaRJetTag;
+    values[ColumnBuffer::avgDeltaR_tag_tag] = avgDeltaRTagTag;
+    values[ColumnBuffer::ptSum_jets_leptons] = ptSumJetsLeptons;
+    values[ColumnBuffer::multiplicity_higgsLikeDijet15] = numberOfHiggsLikeDijet15;
+    values[ColumnBuffer::mass_higgsLikeDijet] = higgsLikeDijetMass;
+    values[ColumnBuffer::mass_higgsLikeDijet2] = higgsLikeDijetMass2;
+    values[ColumnBuffer::mass_jet_jet_min_deltaR] = mass_jet_jet_min_deltaR;
+    values[ColumnBuffer::mass_tag_tag_min_deltaR] = mass_tag_tag_min_deltaR;
+    values[ColumnBuffer::mass_jet_tag_min_deltaR] = mass_jet_tag_min_deltaR;
+    values[ColumnBuffer::mass_tag_tag_max_mass] = mass_tag_tag_max_mass;
+    values[ColumnBuffer::median_mass_jet_jet] = median_mass_jet_jet;
+    values[ColumnBuffer::maxDeltaEta_jet_jet] = maxDeltaEta_jet_jet;
+    values[ColumnBuffer::maxDeltaEta_tag_tag] = maxDeltaEta_tag_tag;
+    values[ColumnBuffer::HT_jets] = sumJetPt;
+    values[ColumnBuffer::HT_tags] = sumTagPt;
+    values[ColumnBuffer::pT_jet_jet_min_deltaR] = pT_jet_jet_min_deltaR;
+    values[ColumnBuffer::pT_jet_tag_min_deltaR] = pT_jet_tag_min_deltaR;
+    values[ColumnBuffer::pT_tag_tag_min_deltaR] = pT_tag_tag_min_deltaR;
+    values[ColumnBuffer::mass_jet_jet_jet_max_pT] = mass_jet_jet_jet_max_pT;
+    values[ColumnBuffer::mass_jet_tag_tag_max_pT] = mass_jet_tag_tag_max_pT;
+    values[ColumnBuffer::centrality_jets_leps] = centrality_jets_leps;
+    values[ColumnBuffer::centrality_tags] = centrality_tags;
+    values[ColumnBuffer::twist_jet_jet_max_mass] = twist_jet_jet_max_mass;
+    values[ColumnBuffer::twist_jet_tag_max_mass] = twist_jet_tag_max_mass;
+    values[ColumnBuffer::twist_tag_tag_max_mass] = twist_tag_tag_max_mass;
+    values[ColumnBuffer::twist_tag_tag_min_deltaR] = twist_tag_tag_min_deltaR;
+    values[ColumnBuffer::sphericity_jet] = sphericity_jet;
+    values[ColumnBuffer::aplanarity_jet] = aplanarity_jet;
+    values[ColumnBuffer::circularity_jet] = circularity_jet;
+    values[ColumnBuffer::isotropy_jet] = isotropy_jet;
+    values[ColumnBuffer::C_jet] = C_jet;
+    values[ColumnBuffer::D_jet] = D_jet;
+    values[ColumnBuffer::transSphericity_jet] = transSphericity_jet;
+    values[ColumnBuffer::sphericity_tag] = sphericity_tag;
+    values[ColumnBuffer::aplanarity_tag] = aplanarity_tag;
+    values[ColumnBuffer::circularity_tag] = circularity_tag;
+    values[ColumnBuffer::isotropy_tag] = isotropy_tag;
+    values[ColumnBuffer::C_tag] = C_tag;
+    values[ColumnBuffer::D_tag] = D_tag;
+    values[ColumnBuffer::transSphericity_tag] = transSphericity_tag;
+    values[ColumnBuffer::H0_jet] = H0_jet;
+    values[ColumnBuffer::H1_jet] = H1_jet;
+    values[ColumnBuffer::H2_jet] = H2_jet;
+    values[ColumnBuffer::H3_jet] = H3_jet;
+    values[ColumnBuffer::H4_jet] = H4_jet;
+    values[ColumnBuffer::R1_jet] = R1_jet;
+    values[ColumnBuffer::R2_jet] = R2_jet;
+    values[ColumnBuffer::R3_jet] = R3_jet;
+    values[ColumnBuffer::R4_jet] = R4_jet;
+    values[ColumnBuffer::H0_tag] = H0_tag;
+    values[ColumnBuffer::H1_tag] = H1_tag;
+    values[ColumnBuffer::H2_tag] = H2_tag;
+    values[ColumnBuffer::H3_tag] = H3_tag;
+    values[ColumnBuffer::H4_tag] = H4_tag;
+    values[ColumnBuffer::R1_tag] = R1_tag;
+    values[ColumnBuffer::R2_tag] = R2_tag;
+    values[ColumnBuffer::R3_tag] = R3_tag;
+    values[ColumnBuffer::R4_tag] = R4_tag;
+    values[ColumnBuffer::mass_bb] = mass_jj;
+}
 
-    int i_index_maxCSV(-999);
-    int j_index_maxCSV(-999);
-    double maxCSV1(-999.);
-    double maxCSV2(-999.);
 
-    for(auto i_index = recoObjectIndices.jetIndices_.begin(); i_index != recoObjectIndices.jetIndices_.end(); ++i_index){
-      //const bool btagged1 = std::find(recoObjectIndices.bjetIndices_.begin(), recoObjectIndices.bjetIndices_.end(), *i_index) != recoObjectIndices.bjetIndices_.end();
-      
-      for(auto j_index = i_index + 1; j_index != recoObjectIndices.jetIndices_.end(); ++j_index){
-        //const bool btagged2 = std::find(recoObjectIndices.bjetIndices_.begin(), recoObjectIndices.bjetIndices_.end(), *j_index) != recoObjectIndices.bjetIndices_.end();
 
-        // Veto jet if it's been tagged as most likely coming from the top-antitop system
-        if((*i_index == topPair.first || *i_index == topPair.second) 
-           || (*j_index == topPair.first || *j_index == topPair.second))
-          continue;
-        
-        // Require at least one b-tagged jet else continue (study requiring at least one b-tagged jet)
-        //if(!btagged1 && !btagged2) continue;
-        
-        if (jetBtags.at(*i_index) > maxCSV1)
-          i_index_maxCSV = *i_index;
-        if (jetBtags.at(*j_index) > maxCSV2)
-          j_index_maxCSV = *j_index;
-        
-        p_mass_jj =  std::make_pair(i_index_maxCSV, j_index_maxCSV);
-        
-      }
+MvaVariablesEventClassification* MvaVariablesEventClassification::fillVariables(const EventMetadata& eventMetadata,
+                                                                                const tth::RecoObjectIndices& recoObjectIndices,
+                                                                                const RecoObjects& recoObjects,
+                                                                                const tth::GenObjectIndices& genObjectIndices,
+                                                                                const double& eventWeight)
+{
+    double values[ColumnBuffer::numberOfVariables];
+    computeVariables(eventMetadata, recoObjectIndices, recoObjects, genObjectIndices, eventWeight, values);
+
+    return new MvaVariablesEventClassification(eventMetadata,
+                                               static_cast<int>(values[ColumnBuffer::multiplicity_jets]),
+                                               values[ColumnBuffer::btagDiscriminatorAverage_tagged],
+                                               values[ColumnBuffer::btagDiscriminatorAverage_untagged],
+                                               values[ColumnBuffer::minDeltaR_jet_jet],
+                                               values[ColumnBuffer::minDeltaR_tag_tag],
+                                               values[ColumnBuffer::avgDeltaR_jet_jet],
+                                               values[ColumnBuffer::avgDeltaR_jet_tag],
+                                               values[ColumnBuffer::avgDeltaR_tag_tag],
+                                               values[ColumnBuffer::ptSum_jets_leptons],
+                                               static_cast<int>(values[ColumnBuffer::multiplicity_higgsLikeDijet15]),
+                                               values[ColumnBuffer::mass_higgsLikeDijet],
+                                               values[ColumnBuffer::mass_higgsLikeDijet2],
+                                               values[ColumnBuffer::mass_jet_jet_min_deltaR],
+                                               values[ColumnBuffer::mass_tag_tag_min_deltaR],
+                                               values[ColumnBuffer::mass_jet_tag_min_deltaR],
+                                               values[ColumnBuffer::mass_tag_tag_max_mass],
+                                               values[ColumnBuffer::median_mass_jet_jet],
+                                               values[ColumnBuffer::maxDeltaEta_jet_jet],
+                                               values[ColumnBuffer::maxDeltaEta_tag_tag],
+                                               values[ColumnBuffer::HT_jets],
+                                               values[ColumnBuffer::HT_tags],
+                                               values[ColumnBuffer::pT_jet_jet_min_deltaR],
+                                               values[ColumnBuffer::pT_jet_tag_min_deltaR],
+                                               values[ColumnBuffer::pT_tag_tag_min_deltaR],
+                                               values[ColumnBuffer::mass_jet_jet_jet_max_pT],
+                                               values[ColumnBuffer::mass_jet_tag_tag_max_pT],
+                                               values[ColumnBuffer::centrality_jets_leps],
+                                               values[ColumnBuffer::centrality_tags],
+                                               values[ColumnBuffer::twist_jet_jet_max_mass],
+                                               values[ColumnBuffer::twist_jet_tag_max_mass],
+                                               values[ColumnBuffer::twist_tag_tag_max_mass],
+                                               values[ColumnBuffer::twist_tag_tag_min_deltaR],
+                                               values[ColumnBuffer::sphericity_jet],
+                                               values[ColumnBuffer::aplanarity_jet],
+                                               values[ColumnBuffer::circularity_jet],
+                                               values[ColumnBuffer::isotropy_jet],
+                                               values[ColumnBuffer::C_jet],
+                                               values[ColumnBuffer::D_jet],
+                                               values[ColumnBuffer::transSphericity_jet],
+                                               values[ColumnBuffer::sphericity_tag],
+                                               values[ColumnBuffer::aplanarity_tag],
+                                               values[ColumnBuffer::circularity_tag],
+                                               values[ColumnBuffer::isotropy_tag],
+                                               values[ColumnBuffer::C_tag],
+                                               values[ColumnBuffer::D_tag],
+                                               values[ColumnBuffer::transSphericity_tag],
+                                               values[ColumnBuffer::H0_jet],
+                                               values[ColumnBuffer::H1_jet],
+                                               values[ColumnBuffer::H2_jet],
+                                               values[ColumnBuffer::H3_jet],
+                                               values[ColumnBuffer::H4_jet],
+                                               values[ColumnBuffer::R1_jet],
+                                               values[ColumnBuffer::R2_jet],
+                                               values[ColumnBuffer::R3_jet],
+                                               values[ColumnBuffer::R4_jet],
+                                               values[ColumnBuffer::H0_tag],
+                                               values[ColumnBuffer::H1_tag],
+                                               values[ColumnBuffer::H2_tag],
+                                               values[ColumnBuffer::H3_tag],
+                                               values[ColumnBuffer::H4_tag],
+                                               values[ColumnBuffer::R1_tag],
+                                               values[ColumnBuffer::R2_tag],
+                                               values[ColumnBuffer::R3_tag],
+                                               values[ColumnBuffer::R4_tag],
+                                               values[ColumnBuffer::mass_bb],
+                                               eventWeight);
+}
+
+
+
+void MvaVariablesEventClassification::fillVariables(const EventMetadata& eventMetadata,
+                                                    const tth::RecoObjectIndices& recoObjectIndices,
+                                                    const RecoObjects& recoObjects,
+                                                    const tth::GenObjectIndices& genObjectIndices,
+                                                    const double& eventWeight,
+                                                    ColumnBuffer& buffer)
+{
+    double values[ColumnBuffer::numberOfVariables];
+    computeVariables(eventMetadata, recoObjectIndices, recoObjects, genObjectIndices, eventWeight, values);
+
+    const size_t event = buffer.size();
+    buffer.resize(event + 1);
+    buffer.set(event, values, eventWeight);
+}
+
+
+
+void MvaVariablesEventClassification::fillVariables(const std::vector<EventInput>& events, ColumnBuffer& buffer)
+{
+    const size_t offset = buffer.size();
+    buffer.resize(offset + events.size());
+
+    double values[ColumnBuffer::numberOfVariables];
+    for(size_t iEvent = 0; iEvent < events.size(); ++iEvent){
+        const EventInput& event = events[iEvent];
+        computeVariables(*event.eventMetadata, *event.recoObjectIndices, *event.recoObjects, *event.genObjectIndices, event.eventWeight, values);
+        buffer.set(offset + iEvent, values, event.eventWeight);
     }
+}
 
-    mass_jj = (p_mass_jj != std::make_pair(-999,-999)) ? (jets.at(p_mass_jj.first) + jets.at(p_mass_jj.second)).M() : -999.;
 
 
-    return new MvaVariablesEventClassification(eventMetadata,
-                                               numberOfJets,
-                                               btagDiscriminatorAverage_tagged, btagDiscriminatorAverage_untagged,
-                                               minDeltaRJetJet, minDeltaRTagTag,
-                                               avgDeltaRJetJet, avgDeltaRJetTag, avgDeltaRTagTag,
-                                               ptSumJetsLeptons,
-                                               numberOfHiggsLikeDijet15,
-                                               higgsLikeDijetMass, higgsLikeDijetMass2,
-                                               mass_jet_jet_min_deltaR, mass_tag_tag_min_deltaR, mass_jet_tag_min_deltaR,
-                                               mass_tag_tag_max_mass,
-                                               median_mass_jet_jet,
-                                               maxDeltaEta_jet_jet, maxDeltaEta_tag_tag,
-                                               sumJetPt, sumTagPt,
-                                               pT_jet_jet_min_deltaR, pT_jet_tag_min_deltaR, pT_tag_tag_min_deltaR,
-                                               mass_jet_jet_jet_max_pT, mass_jet_tag_tag_max_pT,
-                                               centrality_jets_leps, centrality_tags, 
-                                               twist_jet_jet_max_mass, twist_jet_tag_max_mass, twist_tag_tag_max_mass,
-                                               twist_tag_tag_min_deltaR,
-                                               sphericity_jet,  aplanarity_jet,  circularity_jet,  isotropy_jet,
-                                               C_jet,  D_jet, transSphericity_jet,
-                                               sphericity_tag,  aplanarity_tag,  circularity_tag,  isotropy_tag,
-                                               C_tag,  D_tag,  transSphericity_tag,
-                                               H0_jet,  H1_jet,  H2_jet,  H3_jet,  H4_jet,
-                                               R1_jet,  R2_jet,  R3_jet,  R4_jet,
-                                               H0_tag,  H1_tag,  H2_tag,  H3_tag,  H4_tag,
-                                               R1_tag,  R2_tag,  R3_tag,  R4_tag,
-                                               mass_jj,
-                                               eventWeight);
+void MvaVariablesEventClassification::fillVariables(const std::vector<EventInput>& events, ColumnBuffer& buffer,
+                                                    ThreadPool& threadPool, const size_t chunkSize)
+{
+    // Each event is written to its own row, so the threads never share any output element
+    const size_t offset = buffer.size();
+    buffer.resize(offset + events.size());
+
+    // Required by ROOT for the concurrent use of the MVA readers, one per thread
+    if(threadPool.size()) ROOT::EnableThreadSafety();
+
+    // Chunks are taken from a shared counter, so threads finishing early take over the remaining events
+    std::atomic<size_t> nextChunk(0);
+    const size_t eventsPerChunk = std::max<size_t>(chunkSize, 1);
+    const size_t numberOfChunks = (events.size() + eventsPerChunk - 1)/eventsPerChunk;
+    auto processChunks = [&](){
+        double values[ColumnBuffer::numberOfVariables];
+        for(size_t chunk = nextChunk++; chunk < numberOfChunks; chunk = nextChunk++){
+            const size_t end = std::min(events.size(), (chunk + 1)*eventsPerChunk);
+            for(size_t iEvent = chunk*eventsPerChunk; iEvent < end; ++iEvent){
+                const EventInput& event = events[iEvent];
+                computeVariables(*event.eventMetadata, *event.recoObjectIndices, *event.recoObjects, *event.genObjectIndices, event.eventWeight, values);
+                buffer.set(offset + iEvent, values, event.eventWeight);
+            }
+        }
+    };
+
+    const size_t numberOfTasks = std::max<size_t>(threadPool.size(), 1);
+    for(size_t iTask = 0; iTask < numberOfTasks; ++iTask) threadPool.submit(processChunks);
+    threadPool.wait();
 }
 
 
@@ -1293,361 +992,329 @@ MvaVariablesEventClassification* temp::fillVariables(const EventMetadata& eventM
 
 
 
-// ---------------------------------- Class MvaVariablesEventClassification::EventShapeVariables -------------------------------------------
+// ---------------------------------- Class MvaVariablesEventClassification::ColumnBuffer -------------------------------------------
 
 
 
-/// constructor from XYZ coordinates
-MvaVariablesEventClassification::EventShapeVariables::EventShapeVariables(const VLV& inputVectors):
-inputVectors_(makeVecForEventShape(inputVectors))
-{}
+const char* MvaVariablesEventClassification::ColumnBuffer::name(const Variable variable)
+{
+    static const char* const names[numberOfVariables] = {
+        name_multiplicity_jets_,
+        name_btagDiscriminatorAverage_tagged_,
+        name_btagDiscriminatorAverage_untagged_,
+        name_minDeltaR_jet_jet_,
+        name_minDeltaR_tag_tag_,
+        name_avgDeltaR_jet_jet_,
+        name_avgDeltaR_jet_tag_,
+        name_avgDeltaR_tag_tag_,
+        name_ptSum_jets_leptons_,
+        name_multiplicity_higgsLikeDijet15_,
+        name_mass_higgsLikeDijet_,
+        name_mass_higgsLikeDijet2_,
+        name_mass_jet_jet_min_deltaR_,
+        name_mass_tag_tag_min_deltaR_,
+        name_mass_jet_tag_min_deltaR_,
+        name_mass_tag_tag_max_mass_,
+        name_median_mass_jet_jet_,
+        name_maxDeltaEta_jet_jet_,
+        name_maxDeltaEta_tag_tag_,
+        name_HT_jets_,
+        name_HT_tags_,
+        name_pT_jet_jet_min_deltaR_,
+        name_pT_jet_tag_min_deltaR_,
+        name_pT_tag_tag_min_deltaR_,
+        name_mass_jet_jet_jet_max_pT_,
+        name_mass_jet_tag_tag_max_pT_,
+        name_centrality_jets_leps_,
+        name_centrality_tags_,
+        name_twist_jet_jet_max_mass_,
+        name_twist_jet_tag_max_mass_,
+        name_twist_tag_tag_max_mass_,
+        name_twist_tag_tag_min_deltaR_,
+        name_sphericity_jet_,
+        name_aplanarity_jet_,
+        name_circularity_jet_,
+        name_isotropy_jet_,
+        name_C_jet_,
+        name_D_jet_,
+        name_transSphericity_jet_,
+        name_sphericity_tag_,
+        name_aplanarity_tag_,
+        name_circularity_tag_,
+        name_isotropy_tag_,
+        name_C_tag_,
+        name_D_tag_,
+        name_transSphericity_tag_,
+        name_H0_jet_,
+        name_H1_jet_,
+        name_H2_jet_,
+        name_H3_jet_,
+        name_H4_jet_,
+        name_R1_jet_,
+        name_R2_jet_,
+        name_R3_jet_,
+        name_R4_jet_,
+        name_H0_tag_,
+        name_H1_tag_,
+        name_H2_tag_,
+        name_H3_tag_,
+        name_H4_tag_,
+        name_R1_tag_,
+        name_R2_tag_,
+        name_R3_tag_,
+        name_R4_tag_,
+        name_mass_bb_
+    };
+
+    return names[variable];
+}
 
 
 
-std::vector<ROOT::Math::XYZVector> MvaVariablesEventClassification::EventShapeVariables::makeVecForEventShape(const VLV& jets)
+void MvaVariablesEventClassification::ColumnBuffer::reserve(const size_t numberOfEvents)
 {
-  std::vector<ROOT::Math::XYZVector> p;
-
-  for(unsigned int i=0; i< jets.size(); i++){
+    for(std::vector<float>& column : columns_) column.reserve(numberOfEvents);
+    eventWeights_.reserve(numberOfEvents);
+}
 
-    ROOT::Math::XYZVector Vjet;
 
-    Vjet = ROOT::Math::XYZVector(jets[i].Px(), jets[i].Py(), jets[i].Pz());
-    p.push_back(Vjet);
-  }
 
-  return p;
+void MvaVariablesEventClassification::ColumnBuffer::resize(const size_t numberOfEvents)
+{
+    for(std::vector<float>& column : columns_) column.resize(numberOfEvents);
+    eventWeights_.resize(numberOfEvents);
 }
 
 
 
-/// needs the number of steps to determine how fine the granularity of the algorithm in phi should be
-double MvaVariablesEventClassification::EventShapeVariables::isotropy(const unsigned int& numberOfSteps) const
+void MvaVariablesEventClassification::ColumnBuffer::clear()
 {
-  const double deltaPhi=2*TMath::Pi()/numberOfSteps;
-  double phi = 0, eIn =-1., eOut=-1.;
- 
-  for(unsigned int i=0; i<numberOfSteps; ++i){
-    phi+=deltaPhi;
-    double sum=0;
-    
-    for(unsigned int j=0; j<inputVectors_.size(); ++j){
+    for(std::vector<float>& column : columns_) column.clear();
+    eventWeights_.clear();
+}
 
-      // sum over inner product of unit vectors and momenta
-      sum+=TMath::Abs(TMath::Cos(phi)*inputVectors_[j].x()+TMath::Sin(phi)*inputVectors_[j].y());
-    }
-    
-    if( eOut<0. || sum<eOut ) eOut=sum;
-    if( eIn <0. || sum>eIn  ) eIn =sum;
-  }
-  return (eIn-eOut)/eIn;
+
+
+void MvaVariablesEventClassification::ColumnBuffer::set(const size_t event, const double* values, const double& eventWeight)
+{
+    for(int variable = 0; variable < numberOfVariables; ++variable) columns_[variable][event] = values[variable];
+    eventWeights_[event] = eventWeight;
 }
 
 
 
-/// the return value is 1 for spherical and 0 linear events in r-phi.
-double MvaVariablesEventClassification::EventShapeVariables::circularity(const unsigned int& numberOfSteps) const
+
+
+
+
+
+// ---------------------------------- Class MvaVariablesEventClassification::JetKinematics -------------------------------------------
+
+
+
+void MvaVariablesEventClassification::JetKinematics::fill(const VLV& jets, const std::vector<int>& jetIndices, const std::vector<int>& bjetIndices)
 {
-  const double deltaPhi=2*TMath::Pi()/numberOfSteps;
-  double circularity=-1, phi=0, area = 0;
- 
-  for(unsigned int i=0;i<inputVectors_.size();i++) {
-    area+=TMath::Sqrt(inputVectors_[i].x()*inputVectors_[i].x()+inputVectors_[i].y()*inputVectors_[i].y());
-  }
-  
-  for(unsigned int i=0; i<numberOfSteps; ++i){
-    phi+=deltaPhi;
-    double sum=0, tmp=0.;
+    // Clearing keeps the capacity, so that no allocation is needed once the largest event is seen
+    pt_.clear();
+    eta_.clear();
+    phi_.clear();
+    energy_.clear();
+    px_.clear();
+    py_.clear();
+    pz_.clear();
+    tagged_.clear();
+    taggedPositions_.clear();
+    untaggedPositions_.clear();
+    taggedIndices_.clear();
+    
+    const size_t numberOfJets = jetIndices.size();
     
-    for(unsigned int j=0; j<inputVectors_.size(); ++j){
-      sum+=TMath::Abs(TMath::Cos(phi)*inputVectors_[j].x()+TMath::Sin(phi)*inputVectors_[j].y());
+    // Flag the b-tagged jets once, for constant-time lookup by jet index
+    isTaggedJet_.assign(jets.size(), 0);
+    for(const int index : bjetIndices) isTaggedJet_.at(index) = 1;
+    
+    for(const int index : jetIndices){
+        const LV& jet = jets.at(index);
+        pt_.push_back(jet.pt());
+        eta_.push_back(jet.eta());
+        phi_.push_back(jet.phi());
+        energy_.push_back(jet.E());
+        px_.push_back(jet.px());
+        py_.push_back(jet.py());
+        pz_.push_back(jet.pz());
+        tagged_.push_back(isTaggedJet_[index]);
+        if(tagged_.back()){
+            taggedPositions_.push_back(tagged_.size() - 1);
+            taggedIndices_.push_back(index);
+        }
+        else untaggedPositions_.push_back(tagged_.size() - 1);
     }
     
-    tmp=TMath::Pi()/2*sum/area;
+    const size_t numberOfPairs = numberOfJets>1 ? numberOfJets*(numberOfJets-1)/2 : 0;
+    first_.resize(numberOfPairs);
+    second_.resize(numberOfPairs);
+    deltaR_.resize(numberOfPairs);
+    deltaEta_.resize(numberOfPairs);
+    deltaPhi_.resize(numberOfPairs);
+    mass_.resize(numberOfPairs);
+    ptPair_.resize(numberOfPairs);
     
-    if(circularity<0 || tmp<circularity){
-      circularity=tmp;
+    // Same conventions as ROOT::Math::VectorUtil::DeltaPhi and DeltaR
+    size_t pair = 0;
+    for(size_t i = 0; i < numberOfJets; ++i){
+        for(size_t j = i + 1; j < numberOfJets; ++j, ++pair){
+            double deltaPhi = phi_[j] - phi_[i];
+            if(deltaPhi > TMath::Pi()) deltaPhi -= TMath::TwoPi();
+            else if(deltaPhi <= -TMath::Pi()) deltaPhi += TMath::TwoPi();
+            const double deltaEta = eta_[i] - eta_[j];
+            
+            const double px = px_[i] + px_[j];
+            const double py = py_[i] + py_[j];
+            const double pz = pz_[i] + pz_[j];
+            const double energy = energy_[i] + energy_[j];
+            
+            first_[pair] = i;
+            second_[pair] = j;
+            deltaR_[pair] = std::sqrt(deltaPhi*deltaPhi + deltaEta*deltaEta);
+            deltaEta_[pair] = deltaEta;
+            deltaPhi_[pair] = deltaPhi;
+            mass_[pair] = mass(px, py, pz, energy);
+            ptPair_[pair] = std::sqrt(px*px + py*py);
+        }
     }
-  }
-  return circularity;
 }
 
 
 
-// helper function to fill the 3 dimensional momentum tensor from the inputVecotrs where needed
-TMatrixDSym MvaVariablesEventClassification::EventShapeVariables::compMomentumTensor(double r) const
+double MvaVariablesEventClassification::JetKinematics::medianMass()
 {
-  TMatrixDSym momentumTensor(3);
-  momentumTensor.Zero();
-
-  if (inputVectors_.size() < 2){ 
-    return momentumTensor;
-  }
-  
-   // fill momentumTensor from inputVectors
-   double norm = 1.;
-   
-   for ( int i = 0; i < (int)inputVectors_.size(); ++i ){
-
-     double p2 = inputVectors_[i].Dot(inputVectors_[i]);
-
-     double pR = (r == 2.) ? p2 : TMath::Power(p2, 0.5*r);
-     norm += pR;
-
-     double pRminus2 = (r == 2.) ? 1. : TMath::Power(p2, 0.5*r - 1.);
-
-     momentumTensor(0,0) += pRminus2*inputVectors_[i].x()*inputVectors_[i].x();
-     momentumTensor(0,1) += pRminus2*inputVectors_[i].x()*inputVectors_[i].y();
-     momentumTensor(0,2) += pRminus2*inputVectors_[i].x()*inputVectors_[i].z();
-     momentumTensor(1,0) += pRminus2*inputVectors_[i].y()*inputVectors_[i].x();
-     momentumTensor(1,1) += pRminus2*inputVectors_[i].y()*inputVectors_[i].y();
-     momentumTensor(1,2) += pRminus2*inputVectors_[i].y()*inputVectors_[i].z();
-     momentumTensor(2,0) += pRminus2*inputVectors_[i].z()*inputVectors_[i].x();
-     momentumTensor(2,1) += pRminus2*inputVectors_[i].z()*inputVectors_[i].y();
-     momentumTensor(2,2) += pRminus2*inputVectors_[i].z()*inputVectors_[i].z();
-   }
-
-   return (1./norm)*momentumTensor;
+    massBuffer_.assign(mass_.begin(), mass_.end());
+    const size_t n = massBuffer_.size();
+    
+    // Upper middle element in place, for even numbers the lower middle one is the largest before it
+    std::nth_element(massBuffer_.begin(), massBuffer_.begin() + n/2, massBuffer_.end());
+    if(n%2 == 0) return (massBuffer_[n/2] + *std::max_element(massBuffer_.begin(), massBuffer_.begin() + n/2))/2;
+    return massBuffer_[n/2];
 }
 
 
 
-/// helper function to fill the 3 dimensional vector of eigen-values;
-/// the largest (smallest) eigen-value is stored at index position 0 (2)
-TVectorD MvaVariablesEventClassification::EventShapeVariables::compEigenValues(double r) const
+double MvaVariablesEventClassification::JetKinematics::mass(const double px, const double py, const double pz, const double energy)
 {
-  TVectorD eigenValues(3);
-  TMatrixDSym myTensor = compMomentumTensor(r);
-  
-  if(myTensor.IsSymmetric()){
-    if(myTensor.NonZeros() != 0) myTensor.EigenVectors(eigenValues);
-   }
-
-   return eigenValues;
+    const double mass2 = energy*energy - (px*px + py*py + pz*pz);
+    return mass2 >= 0. ? std::sqrt(mass2) : -std::sqrt(-mass2);
 }
 
 
 
-/// Return values are 1 for spherical, 3/4 for plane and 0 for linear events
-double MvaVariablesEventClassification::EventShapeVariables::sphericity(double r) const
-{
-  TVectorD eigenValues = compEigenValues(r);
 
-  return 1.5*(eigenValues(1) + eigenValues(2));
-}
 
 
 
-/// Return values are 0.5 for spherical and 0 for plane and linear events
-double MvaVariablesEventClassification::EventShapeVariables::aplanarity(double r) const
-{
-  TVectorD eigenValues = compEigenValues(r);
-  
-  return 1.5*eigenValues(2);
-}
+
+// ---------------------------------- Class MvaVariablesEventClassification::EventShapeVariables -------------------------------------------
 
 
 
-/// Return value is between 0 and 1 and measures the 3-jet structure of the event (C vanishes for a "perfect" 2-jet event)
-double MvaVariablesEventClassification::EventShapeVariables::C(double r) const
+/// constructor from the momenta of the jets with given indices
+MvaVariablesEventClassification::EventShapeVariables::EventShapeVariables(const VLV& jets, const std::vector<int>& indices):
+isComputed_(false),
+computedR_(0.)
 {
-  TVectorD eigenValues = compEigenValues(r);
-  
-   return 3.*(eigenValues(0)*eigenValues(1) + eigenValues(0)*eigenValues(2) + eigenValues(1)*eigenValues(2));
+  engine_.setInputs(jets, indices);
 }
 
 
 
-/// Return value is between 0 and 1 and measures the 4-jet structure of the event (D vanishes for a planar event)
-double MvaVariablesEventClassification::EventShapeVariables::D(double r) const
+const MvaVariablesEventClassification::EventShapeVariables::Engine& MvaVariablesEventClassification::EventShapeVariables::engine(double r) const
 {
-  TVectorD eigenValues = compEigenValues(r);
-  
-  return 27.*eigenValues(0)*eigenValues(1)*eigenValues(2);
+  if(!isComputed_ || r != computedR_){
+    engine_.compute(r);
+    computedR_ = r;
+    isComputed_ = true;
+  }
+
+  return engine_;
 }
 
 
 
-/// Return value is between 0 and 1, value of 0 is "pencile-like" limit, while 1 for "isotropic-like" limit  
-double MvaVariablesEventClassification::EventShapeVariables::transSphericity(double r) const 
+/// the return value is 1 for spherical events and 0 for events linear in r-phi.
+double MvaVariablesEventClassification::EventShapeVariables::isotropy() const
 {
-  
-  TVectorD eigenValues = compEigenValues(r);
-  
-  return 2.*eigenValues(1)/(eigenValues(0) + eigenValues(1));
+  return engine().isotropy();
 }
 
 
 
-/// Calcualtes the Fox-Wolfram moment for a given order
-double MvaVariablesEventClassification::EventShapeVariables::H(int i) const 
+/// the return value is 1 for spherical and 0 linear events in r-phi.
+double MvaVariablesEventClassification::EventShapeVariables::circularity() const
 {
-
-  FoxWolframMoments fwm(i);
-  fwm.Compute(inputVectors_);
-  
-  return fwm.H(i);
+  return engine().circularity();
 }
 
 
 
-// Calcualtes the 0-th Fox-Wolfram moment
-double MvaVariablesEventClassification::EventShapeVariables::ZerothMoment() const 
+/// Return values are 1 for spherical, 3/4 for plane and 0 for linear events
+double MvaVariablesEventClassification::EventShapeVariables::sphericity(double r) const
 {
-  FoxWolframMoments fwm(0);
-  fwm.Compute(inputVectors_);
-  
-  return fwm.ZerothMoment();
+  return engine(r).sphericity();
 }
 
 
 
-// Calculates the ratio between Fox-Wolfram moments
-double MvaVariablesEventClassification::EventShapeVariables::R(int order) const
+/// Return values are 0.5 for spherical and 0 for plane and linear events
+double MvaVariablesEventClassification::EventShapeVariables::aplanarity(double r) const
 {
-  
-  FoxWolframMoments fwm(order);
-  fwm.Compute(inputVectors_);
-
-  return fwm.R(order);
+  return engine(r).aplanarity();
 }
 
 
 
+/// Return value is between 0 and 1 and measures the 3-jet structure of the event (C vanishes for a "perfect" 2-jet event)
+double MvaVariablesEventClassification::EventShapeVariables::C(double r) const
+{
+  return engine(r).C();
+}
 
 
 
-
-
-// ---------------------------------- Class MvaVariablesEventClassification::FoxWolframMoments -------------------------------------------
-
-
-
-MvaVariablesEventClassification::FoxWolframMoments::FoxWolframMoments(int maxorder):
-_nmom( maxorder+1 ),
-_FWarray( _nmom ),
-_sumarray( _nmom )
-{}
+/// Return value is between 0 and 1 and measures the 4-jet structure of the event (D vanishes for a planar event)
+double MvaVariablesEventClassification::EventShapeVariables::D(double r) const
+{
+  return engine(r).D();
+}
 
 
 
-void MvaVariablesEventClassification::FoxWolframMoments::Compute(const std::vector<ROOT::Math::XYZVector>& inputVectors)
+/// Return value is between 0 and 1, value of 0 is "pencile-like" limit, while 1 for "isotropic-like" limit
+double MvaVariablesEventClassification::EventShapeVariables::transSphericity(double r) const
 {
-  // initialize
-  Reset();
-  
-  if(inputVectors.size()== 0) 
-    return;
-  
-  double s = 0.;
-  int l;
-  
-  // Start a loop over the all particle candidates
-  for(unsigned int i=0; i<inputVectors.size(); ++i){
-
-    // Candidate particle's 3-momentum
-    TVector3 p1(inputVectors[i].X(),inputVectors[i].Y(),inputVectors[i].Z());
-    double pmag1 = p1.Mag();
-    
-    // loop over other particle's candidates, starting at the next one in the list
-    for(unsigned int j=i; j<inputVectors.size(); ++j){
-      
-      // Candidate particle's 3-momentum
-      TVector3 p2(inputVectors[j].X(),inputVectors[j].Y(),inputVectors[j].Z());
-      double pmag2 = p2.Mag();
-        
-      // the cosine of the angle between the two candidate particles
-      double cosPhi =  cos( p1.Angle(p2) );
-      
-      // the contribution of this pair of track
-      // (note the factor 2 : the pair enters the sum twice)
-      for( l=0; l<_nmom; l++ )
-    _sumarray(l) += 2 * pmag1 * pmag2 * Legendre( l, 0, cosPhi );
-    }
-    
-    // contribution for this moment
-    for( l=0; l<_nmom; l++ )
-      _sumarray(l) += pmag1*pmag1*Legendre( l, 0, 1. );
-      
-    // total energy
-    s += p1.Mag();
-    
-  }
-  
-  // In case of
-  if( s<=0. ) return;
-   
-  // normalize Fox Wolfram Moments
-  for(int i=0; i<_nmom; i++)
-    _FWarray(i) = _sumarray(i)/pow(s,2) ;
+  return engine(r).transSphericity();
 }
 
 
 
-void MvaVariablesEventClassification::FoxWolframMoments::Reset() 
+/// Calcualtes the Fox-Wolfram moment for a given order
+double MvaVariablesEventClassification::EventShapeVariables::H(int i) const 
 {
-  for ( int i = 0; i< _nmom; ++i) 
-    { 
-      _FWarray(i) = 0.;
-      _sumarray(i) = 0.;
-    }
+  return engine().H(i);
 }
 
 
 
-double MvaVariablesEventClassification::FoxWolframMoments::R( int order ) const
+// Calcualtes the 0-th Fox-Wolfram moment
+double MvaVariablesEventClassification::EventShapeVariables::ZerothMoment() const 
 {
-  if(H(0) > 0.) {
-    if(order < _nmom){ 
-      return (H(order)/H(0));
-    }
-  }
-  return 0.;
+  return engine().H(0);
 }
 
 
 
-double MvaVariablesEventClassification::FoxWolframMoments::Legendre( int l, int m, double x )
+// Calculates the ratio between Fox-Wolfram moments
+double MvaVariablesEventClassification::EventShapeVariables::R(int order) const
 {
-  assert(m >= 0.);
-  assert(m <= l);
-  assert(fabs(x) <= 1.);
-  
-  double pmm = 1.;
-  
-  if(m > 0)
-    {
-      double somx2 = sqrt((1. - x) * (1. + x));
-      double fact = 1.;
-      
-      for(int i=0; i<m; i++)
-    {
-      pmm *= -fact * somx2;
-      fact += 2.0;
-    }
-    }
-  
-  if(l == m)
-    return pmm;
-  
-  else
-    {
-      double pmmp1 = x * (2 * m + 1) * pmm;
-   
-      if(l == m + 1)
-    return pmmp1;
-      else
-    {
-      for(int ll = m+2; ll <= l; ++ll)
-        {
-          double pll = (x*(2 * ll - 1)*pmmp1 - (ll + m - 1)*pmm)/(ll - m);
-          pmm = pmmp1;
-          pmmp1 = pll;
-        }
-      
-      return pmmp1;
-    }
-    }
+  return engine().R(order);
 }
 
 
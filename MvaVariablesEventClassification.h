@@ -3,13 +3,11 @@
 
 #include <vector>
 
-#include <TVector.h>
-#include <TVectorD.h>
-#include <TMatrixDSym.h>
-#include <Math/Vector3D.h>
+#include <TMath.h>
 
 #include "../../common/include/classesFwd.h"
 #include "MvaVariablesBase.h"
+#include "EventShapeEngine.h"
 
 class EventMetadata;
 class RecoObjects;
@@ -21,6 +19,7 @@ namespace tth{
     class RecoObjectIndices;
 }
 class MvaReaderBase;
+class ThreadPool;
 
 
 class MvaVariablesEventClassification : public MvaVariablesBase{
@@ -113,6 +112,34 @@ public:
                                                           const tth::GenObjectIndices& genObjectIndices,
                                                           const double& eventWeight);
     
+    /// Columnar buffer of the MVA input variables of many events
+    class ColumnBuffer;
+    
+    /// Inputs of one event, for the production of the MVA input variables in batches
+    struct EventInput{
+        const EventMetadata* eventMetadata;
+        const tth::RecoObjectIndices* recoObjectIndices;
+        const RecoObjects* recoObjects;
+        const tth::GenObjectIndices* genObjectIndices;
+        double eventWeight;
+    };
+    
+    /// Fill the MVA input variables for one event into the next row of the columnar buffer, without a per-event object
+    static void fillVariables(const EventMetadata& eventMetadata,
+                              const tth::RecoObjectIndices& recoObjectIndices,
+                              const RecoObjects& recoObjects,
+                              const tth::GenObjectIndices& genObjectIndices,
+                              const double& eventWeight,
+                              ColumnBuffer& buffer);
+    
+    /// Fill the MVA input variables for a batch of events into the next rows of the columnar buffer
+    static void fillVariables(const std::vector<EventInput>& events, ColumnBuffer& buffer);
+    
+    /// Fill the MVA input variables for a batch of events into the next rows of the columnar buffer,
+    /// with the events processed in chunks taken dynamically by the worker threads of the pool
+    static void fillVariables(const std::vector<EventInput>& events, ColumnBuffer& buffer,
+                              ThreadPool& threadPool, const size_t chunkSize = 64);
+    
 //    /// Fill the MVA input structs from CommonClassifier for one event
 //     static DLBDTMvaVariablesEventClassification* dlBdtFillVariables(const EventMetadata& eventMetadata,
 //                                                                     const tth::RecoObjectIndices& recoObjectIndices,
@@ -304,9 +331,18 @@ private:
      static constexpr const char* name_mass_bb_ = "mass_bb";
 
 
+    /// Compute the MVA input variables for one event, values indexed by ColumnBuffer::Variable
+    static void computeVariables(const EventMetadata& eventMetadata,
+                                 const tth::RecoObjectIndices& recoObjectIndices,
+                                 const RecoObjects& recoObjects,
+                                 const tth::GenObjectIndices& genObjectIndices,
+                                 const double& eventWeight,
+                                 double* values);
+    
+    
     class TopPairVariable;
+    class JetKinematics;
     class EventShapeVariables;
-    class FoxWolframMoments;
 };
 
 
@@ -322,17 +358,132 @@ namespace temp{
     
 }
 
+class MvaVariablesEventClassification::ColumnBuffer{
+    
+public:
+    /// Index of each MVA input variable, in the order of the variables of MvaVariablesEventClassification
+    enum Variable{
+        multiplicity_jets,
+        btagDiscriminatorAverage_tagged,
+        btagDiscriminatorAverage_untagged,
+        minDeltaR_jet_jet,
+        minDeltaR_tag_tag,
+        avgDeltaR_jet_jet,
+        avgDeltaR_jet_tag,
+        avgDeltaR_tag_tag,
+        ptSum_jets_leptons,
+        multiplicity_higgsLikeDijet15,
+        mass_higgsLikeDijet,
+        mass_higgsLikeDijet2,
+        mass_jet_jet_min_deltaR,
+        mass_tag_tag_min_deltaR,
+        mass_jet_tag_min_deltaR,
+        mass_tag_tag_max_mass,
+        median_mass_jet_jet,
+        maxDeltaEta_jet_jet,
+        maxDeltaEta_tag_tag,
+        HT_jets,
+        HT_tags,
+        pT_jet_jet_min_deltaR,
+        pT_jet_tag_min_deltaR,
+        pT_tag_tag_min_deltaR,
+        mass_jet_jet_jet_max_pT,
+        mass_jet_tag_tag_max_pT,
+        centrality_jets_leps,
+        centrality_tags,
+        twist_jet_jet_max_mass,
+        twist_jet_tag_max_mass,
+        twist_tag_tag_max_mass,
+        twist_tag_tag_min_deltaR,
+        sphericity_jet,
+        aplanarity_jet,
+        circularity_jet,
+        isotropy_jet,
+        C_jet,
+        D_jet,
+        transSphericity_jet,
+        sphericity_tag,
+        aplanarity_tag,
+        circularity_tag,
+        isotropy_tag,
+        C_tag,
+        D_tag,
+        transSphericity_tag,
+        H0_jet,
+        H1_jet,
+        H2_jet,
+        H3_jet,
+        H4_jet,
+        R1_jet,
+        R2_jet,
+        R3_jet,
+        R4_jet,
+        H0_tag,
+        H1_tag,
+        H2_tag,
+        H3_tag,
+        H4_tag,
+        R1_tag,
+        R2_tag,
+        R3_tag,
+        R4_tag,
+        mass_bb,
+        numberOfVariables
+    };
+    
+    /// Constructor
+    ColumnBuffer(){};
+    
+    /// Default destructor
+    ~ColumnBuffer(){};
+    
+    /// Name of the variable, held once for all events (e.g. for TTree branches or MVA reader inputs)
+    static const char* name(const Variable variable);
+    
+    /// Number of events in the buffer
+    size_t size()const{return eventWeights_.size();}
+    
+    /// Reserve memory for given number of events
+    void reserve(const size_t numberOfEvents);
+    
+    /// Set the number of events in the buffer, new events are filled with 0
+    void resize(const size_t numberOfEvents);
+    
+    /// Remove all events, keeping the allocated memory
+    void clear();
+    
+    /// Set the variables of the event at given position, values indexed by Variable
+    void set(const size_t event, const double* values, const double& eventWeight);
+    
+    /// Values of the variable for all events, contiguous in memory (integer variables are stored as float)
+    const std::vector<float>& column(const Variable variable)const{return columns_[variable];}
+    
+    /// Weights of all events
+    const std::vector<float>& eventWeights()const{return eventWeights_;}
+    
+private:
+    /// One contiguous array per variable
+    std::vector<float> columns_[numberOfVariables];
+    
+    /// Event weights
+    std::vector<float> eventWeights_;
+};
+
+
+
+
 class MvaVariablesEventClassification::TopPairVariable{
     
 public:
     explicit TopPairVariable(std::string weight_topSystemBDT);
-    ~ TopPairVariable(){};
+    ~ TopPairVariable();
     
     /// MVA weights of correct dijet assignment for top system                                                                                                              
     MvaReaderBase* topSystemWeight_;
     
-    static TopPairVariable& Instance(std::string weight_topSystemBDT) {
-        static TopPairVariable mvaCharge(weight_topSystemBDT);
+    /// Instance of the calling thread, each thread books its own MVA reader
+    static TopPairVariable& Instance(const std::string& weight_topSystemBDT) {
+        static thread_local TopPairVariable mvaCharge(weight_topSystemBDT);
         return mvaCharge;
     }
     
@@ -350,19 +501,93 @@ private:
 
 
 
+class MvaVariablesEventClassification::JetKinematics{
+    
+public:
+    /// Constructor, for no jets
+    JetKinematics(){};
+    
+    /// Default destructor
+    ~JetKinematics(){};
+    
+    /// Gather the selected jets and compute the quantities of all jet pairs, reusing the storage of the previous event
+    void fill(const VLV& jets, const std::vector<int>& jetIndices, const std::vector<int>& bjetIndices);
+    
+    /// Median of the masses of all jet pairs, requires at least one pair
+    double medianMass();
+    
+    /// Number of selected jets
+    size_t size()const{return pt_.size();}
+    
+    /// Number of jet pairs, ordered as the nested loops over the selected jets: (0,1), (0,2), ..., (1,2), ...
+    size_t numberOfPairs()const{return mass_.size();}
+    
+    /// Index of the pair of the jets at positions i<j
+    size_t pair(const size_t i, const size_t j)const{return i*(2*size() - i - 1)/2 + j - i - 1;}
+    
+    /// Twist angle of the pair, i.e. atan(deltaPhi/deltaEta)
+    double twist(const size_t pair)const{return TMath::ATan(deltaPhi_[pair]/deltaEta_[pair]);}
+    
+    /// Invariant mass of the four-momentum, negative for space-like four-momenta as for LV
+    static double mass(const double px, const double py, const double pz, const double energy);
+    
+    /// Kinematics of the selected jets, indexed by position in the jet indices
+    std::vector<double> pt_;
+    std::vector<double> eta_;
+    std::vector<double> phi_;
+    std::vector<double> energy_;
+    std::vector<double> px_;
+    std::vector<double> py_;
+    std::vector<double> pz_;
+    
+    /// Whether the jet is b-tagged, indexed by index in the jet collection
+    std::vector<char> isTaggedJet_;
+    
+    /// Whether the selected jet is b-tagged, indexed by position in the jet indices
+    std::vector<char> tagged_;
+    
+    /// Positions of the b-tagged and of the untagged selected jets, in ascending order
+    std::vector<int> taggedPositions_;
+    std::vector<int> untaggedPositions_;
+    
+    /// Indices in the jet collection of the b-tagged selected jets, in the order of the jet indices
+    std::vector<int> taggedIndices_;
+    
+    /// Positions of the two jets of each pair
+    std::vector<int> first_;
+    std::vector<int> second_;
+    
+    /// Quantities of each jet pair, with deltaEta = eta1 - eta2 and deltaPhi = phi2 - phi1 in [-pi,pi]
+    std::vector<double> deltaR_;
+    std::vector<double> deltaEta_;
+    std::vector<double> deltaPhi_;
+    std::vector<double> mass_;
+    std::vector<double> ptPair_;
+    
+private:
+    /// Reused buffer for the partial ordering of the pair masses
+    std::vector<double> massBuffer_;
+};
+
+
+
+
 class MvaVariablesEventClassification::EventShapeVariables{
     
 public:
-    /// Constructor from XYZ coordinates
-    explicit EventShapeVariables(const VLV& inputVectors);
+    /// Constructor from the momenta of the jets with given indices, without copying the jet collection
+    EventShapeVariables(const VLV& jets, const std::vector<int>& indices);
         
     /// Default destructor  
     ~EventShapeVariables(){};
     
+    /// Number of input vectors held in the object itself, more are stored on the heap
+    static constexpr size_t maxLocalInputs = 16;
+    
     /// The return value is 1 for spherical events and 0 for events linear in r-phi.
-    double isotropy(const unsigned int& numberOfSteps = 1000) const;
+    double isotropy() const;
     /// The return value is 1 for spherical and 0 linear events in r-phi.
-    double circularity(const unsigned int& numberOfSteps = 1000) const;
+    double circularity() const;
     /// 1.5*(v1+v2) where 0<=v1<=v2<=v3 are the eigenvalues of the momemtum tensor 
     /// sum{p_j[a]*p_j[b]}/sum{p_j**2} normalized to 1. Return values are 1 for spherical, 3/4 for 
     /// plane and 0 for linear events
@@ -383,23 +608,29 @@ public:
     /// and measures "isotropic" structore for a value of 1 and "pencile-like" limit for value of 0
     double transSphericity(double = 2.)  const;
     
-    /// Fox Wolfram moment calculations
+    /// Fox Wolfram moment calculations, up to order 4 (0 for higher orders)
     double H(int order) const;
     /// Zeroth moment to be used
     double ZerothMoment() const;
-    /// Ratio between one of the Fox Wolfram moment to the 0-th Fox Wolfram moment
+    /// Ratio between one of the Fox Wolfram moment to the 0-th Fox Wolfram moment, up to order 4 (0 for higher orders)
     double R(int order) const;
     
 private:
-    /// Helper function to fill the 3 dimensional momentum tensor from the inputVectors
-    TMatrixDSym compMomentumTensor(double = 2.) const;
-    TVectorD compEigenValues(double = 2.) const;
+    EventShapeVariables(const EventShapeVariables&) = delete;
+    EventShapeVariables& operator=(const EventShapeVariables&) = delete;
+    
+    /// Engine computing all event shapes in double precision, with Fox Wolfram moments up to the order used
+    typedef EventShapeEngine<double, maxLocalInputs, EventShapeObservable::all, 4> Engine;
     
-    /// Cashing of input vectors
-    std::vector<ROOT::Math::XYZVector> inputVectors_;
+    /// Engine holding the results for given r, computed at the first request and cached for the following ones
+    const Engine& engine(double r = 2.) const;
     
-    /// Method used to convert vector of LV to XYZVector type
-    std::vector<ROOT::Math::XYZVector> makeVecForEventShape(const VLV& jets);
+    /// Engine holding the input vectors
+    mutable Engine engine_;
+    
+    /// Whether results are computed, and for which r
+    mutable bool isComputed_;
+    mutable double computedR_;
 };
 
 
@@ -408,30 +639,6 @@ private:
 
 
 
-class MvaVariablesEventClassification::FoxWolframMoments{
-    
-public:
-    FoxWolframMoments(int order = 4);
-    ~FoxWolframMoments(){};
-    
-    /// Compute given input vector, which is a collection of physics objects
-    void Compute(const std::vector<ROOT::Math::XYZVector>& inputVectors);
-    void Reset();
-    
-    /// Method of class
-    const TVector& Moments()  const     { return _FWarray; }   
-    const TVector& SumArray() const     { return _sumarray; } 
-    double H(int order)   const     { return _FWarray(order); }
-    double ZerothMoment() const     { return _FWarray(0); } 
-    double R(int order) const;    // normalized to zeroth-moment
-    
-    static double Legendre(int l, int m, double x);
-    
-private:
-    int _nmom;
-    TVector _FWarray;
-    TVector _sumarray;
-};
     
 
 
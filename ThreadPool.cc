@@ -0,0 +1,77 @@
+#include "ThreadPool.h"
+
+
+
+
+
+ThreadPool::ThreadPool(const size_t numberOfThreads):
+pending_(0),
+stop_(false)
+{
+  for(size_t iThread = 0; iThread < numberOfThreads; ++iThread){
+    workers_.emplace_back(&ThreadPool::work, this);
+  }
+}
+
+
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  taskAvailable_.notify_all();
+
+  for(std::thread& worker : workers_) worker.join();
+}
+
+
+
+void ThreadPool::submit(const std::function<void()>& task)
+{
+  // No worker threads, execute directly
+  if(workers_.empty()){
+    task();
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    tasks_.push(task);
+    ++pending_;
+  }
+  taskAvailable_.notify_one();
+}
+
+
+
+void ThreadPool::wait()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  taskFinished_.wait(lock, [this]{return pending_ == 0;});
+}
+
+
+
+void ThreadPool::work()
+{
+  while(true){
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      taskAvailable_.wait(lock, [this]{return stop_ || !tasks_.empty();});
+      if(tasks_.empty()) return;
+      task = std::move(tasks_.front());
+      tasks_.pop();
+    }
+
+    task();
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      --pending_;
+    }
+    taskFinished_.notify_all();
+  }
+}
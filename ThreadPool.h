@@ -0,0 +1,70 @@
+#ifndef ThreadPool_h
+#define ThreadPool_h
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+
+
+
+
+/// Simple fixed size pool of worker threads executing tasks in order of submission
+/// A pool of size 0 executes each task immediately in the calling thread
+class ThreadPool{
+
+ public:
+
+  /// Constructor, starting the worker threads
+  explicit ThreadPool(const size_t numberOfThreads);
+
+  /// Destructor, finishing all pending tasks before joining the worker threads
+  ~ThreadPool();
+
+  /// Add task to the queue
+  void submit(const std::function<void()>& task);
+
+  /// Block until all submitted tasks are finished
+  void wait();
+
+  /// Number of worker threads
+  size_t size()const{return workers_.size();}
+
+ private:
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /// Loop of each worker thread, executing tasks until the pool is stopped
+  void work();
+
+  /// Worker threads
+  std::vector<std::thread> workers_;
+
+  /// Tasks waiting for execution
+  std::queue<std::function<void()> > tasks_;
+
+  /// Number of tasks submitted but not yet finished
+  size_t pending_;
+
+  /// Set to true to stop the worker threads once the queue is empty
+  bool stop_;
+
+  /// Protects queue and counters
+  std::mutex mutex_;
+
+  /// Signals new tasks or stopping to the workers
+  std::condition_variable taskAvailable_;
+
+  /// Signals finished tasks to waiting threads
+  std::condition_variable taskFinished_;
+};
+
+
+
+
+
+#endif
@@ -0,0 +1,216 @@
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include <TString.h>
+#include <TFile.h>
+#include <TH1D.h>
+#include <TRandom3.h>
+#include <TSystem.h>
+
+#include "AnalysisConfig.h"
+#include "DatacardMaker.h"
+#include "DatacardProfiler.h"
+#include "../../common/include/sampleHelpers.h"
+#include "../../common/include/CommandLineParameters.h"
+
+
+
+
+
+/// Event categories available in the datacard maker
+const std::vector<std::string> benchmarkCategories = {
+  "cate0", "cate1", "cate2", "cate3", "cate4", "cate3Low", "cate3High", "cate4Low", "cate4High",
+};
+
+/// Processes available in the datacard maker, signal first
+const std::vector<std::string> benchmarkProcesses = {
+  "ttHbb", "ttHnobb", "ttbb", "ttb", "tt2b", "ttcc", "ttOther", "singleTop", "ttZ", "ttW", "diboson", "dy", "wlnu", "ttGamma", "qcd",
+};
+
+/// Shape systematics used for the synthetic inputs, each with up and down variation
+const std::vector<Systematic::Type> benchmarkSystematics = {
+  Systematic::jesAbsoluteStat, Systematic::jesAbsoluteScale, Systematic::jesAbsoluteMPFBias, Systematic::jesFragmentation,
+  Systematic::jesSinglePionECAL, Systematic::jesSinglePionHCAL, Systematic::jesFlavorQCD, Systematic::jesTimePtEta,
+  Systematic::jesRelativeJEREC1, Systematic::jesRelativeJEREC2, Systematic::jesRelativeJERHF, Systematic::jesRelativePtBB,
+  Systematic::jesRelativePtEC1, Systematic::jesRelativePtEC2, Systematic::jesRelativePtHF, Systematic::jesRelativeFSR,
+  Systematic::jesRelativeStatFSR, Systematic::jesRelativeStatEC, Systematic::jesRelativeStatHF, Systematic::jesRelativeBal,
+  Systematic::jesPileUpDataMC, Systematic::jesPileUpPtRef, Systematic::jesPileUpPtBB, Systematic::jesPileUpPtEC1,
+  Systematic::jesPileUpPtEC2, Systematic::jesPileUpPtHF,
+};
+
+
+
+/// Write synthetic <name>_source.root files and the HistoFileList_<systematic>_<channel>.txt lists pointing to them (relative to the working directory)
+void generateInputs(const std::string& workDir,
+                    const std::vector<std::string>& fileNames,
+                    const std::vector<std::string>& processNames,
+                    const std::vector<Channel::Channel>& v_channel,
+                    const std::vector<Systematic::Systematic>& v_systematic,
+                    const int nBins)
+{
+  TRandom3 random(4357);
+
+  for(Channel::Channel channel : v_channel) {
+    for(const Systematic::Systematic& systematic : v_systematic) {
+
+      const TString inputDir = TString::Format("inputs/%s/%s", systematic.name().Data(), Channel::convert(channel).Data());
+      gSystem->mkdir(TString(workDir+"/")+inputDir, kTRUE);
+
+      std::ofstream fileList(TString::Format("%s/FileLists/HistoFileList_%s_%s.txt", workDir.c_str(), systematic.name().Data(), Channel::convert(channel).Data()).Data());
+
+      for(const std::string& fileName : fileNames) {
+
+        const TString inputFileName = inputDir+"/"+fileName+"_source.root";
+        fileList << inputFileName << "\n";
+
+        TFile file(TString(workDir+"/")+inputFileName, "RECREATE");
+
+        // Falling spectra, with a process dependent normalisation
+        for(size_t iProcess = 0; iProcess < processNames.size(); ++iProcess) {
+          TH1D histo(TString(fileName+"_"+processNames[iProcess]), processNames[iProcess].c_str(), nBins, -1., 1.);
+          histo.Sumw2();
+          const double norm = 1000./(iProcess+1);
+          for(int iBin = 1; iBin <= nBins; ++iBin) {
+            const double expected = norm*std::exp(-2.*iBin/nBins);
+            const double content = random.Gaus(expected, std::sqrt(expected)*0.1);
+            histo.SetBinContent(iBin, std::max(content, 0.));
+            histo.SetBinError(iBin, std::sqrt(std::max(content, 1.))*0.3);
+          }
+          histo.Write();
+        }
+        file.Close();
+      }
+    }
+  }
+}
+
+
+
+/// Generate the synthetic inputs in a child process, so that their production does not enter the peak RSS of the benchmark,
+/// returns false if the generation failed
+bool generateInputsSeparately(const std::string& workDir,
+                              const std::vector<std::string>& fileNames,
+                              const std::vector<std::string>& processNames,
+                              const std::vector<Channel::Channel>& v_channel,
+                              const std::vector<Systematic::Systematic>& v_systematic,
+                              const int nBins)
+{
+  // Buffered output would be written by both processes otherwise
+  std::cout << std::flush;
+
+  const pid_t pid = fork();
+  if(pid < 0) return false;
+
+  if(pid == 0) {
+    generateInputs(workDir, fileNames, processNames, v_channel, v_systematic, nBins);
+    std::cout << std::flush;
+    _exit(0);
+  }
+
+  int status(0);
+  if(waitpid(pid, &status, 0) != pid) return false;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+
+/// Peak resident set size of the process in MB
+double peakRss()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  // Linux reports kilobytes
+  return usage.ru_maxrss/1024.;
+}
+
+
+
+int main(int argc, char** argv){
+
+  // Get and check configuration parameters
+  CLParameter<std::string> opt_categories("categories", "Number of event categories, default set to 9 (maximum)", false, 1, 1);
+  CLParameter<std::string> opt_processes("processes", "Number of MC processes, default set to 10", false, 1, 1);
+  CLParameter<std::string> opt_bins("bins", "Number of bins per histogram, default set to 20", false, 1, 1);
+  CLParameter<std::string> opt_systematics("systematics", "Number of shape systematics with up and down variation, default set to 10", false, 1, 1);
+  CLParameter<std::string> opt_threads("j", "Number of datacards produced in parallel, default set to 1", false, 1, 1);
+  CLParameter<std::string> opt_workDir("d", "Working directory for synthetic inputs and outputs, default set to datacardBenchmark", false, 1, 1);
+  CLParameter<std::string> opt_keepInputs("keepInputs", "Reuse synthetic inputs of a previous benchmark in the working directory, default set to false", false, 1, 1);
+  CLAnalyser::interpretGlobal(argc, argv);
+
+  const size_t nCategories = std::min<size_t>(opt_categories.isSet() ? std::atoi((opt_categories.getArguments())[0].c_str()) : 9, benchmarkCategories.size());
+  const size_t nProcesses = std::min<size_t>(opt_processes.isSet() ? std::atoi((opt_processes.getArguments())[0].c_str()) : 10, benchmarkProcesses.size());
+  const size_t nSystematics = std::min<size_t>(opt_systematics.isSet() ? std::atoi((opt_systematics.getArguments())[0].c_str()) : 10, benchmarkSystematics.size());
+  const int nBins = opt_bins.isSet() ? std::atoi((opt_bins.getArguments())[0].c_str()) : 20;
+  const int nThreads = opt_threads.isSet() ? std::atoi((opt_threads.getArguments())[0].c_str()) : 1;
+  const std::string workDir = opt_workDir.isSet() ? (opt_workDir.getArguments())[0] : "datacardBenchmark";
+  const bool keepInputs = opt_keepInputs.isSet() && (opt_keepInputs.getArguments())[0] == "true";
+
+  // Set up benchmark configuration
+  std::vector<std::string> fileNames;
+  for(size_t i = 0; i < nCategories; ++i) fileNames.push_back("mvaEventA_benchmark_"+benchmarkCategories[i]);
+
+  std::vector<std::string> processNames(benchmarkProcesses.begin(), benchmarkProcesses.begin()+nProcesses);
+  processNames.push_back("data");
+
+  const std::vector<Channel::Channel> v_channel = {Channel::combined};
+
+  std::vector<Systematic::Systematic> v_systematic = {Systematic::nominalSystematic()};
+  for(size_t i = 0; i < nSystematics; ++i) {
+    v_systematic.push_back(Systematic::Systematic(benchmarkSystematics[i], Systematic::up));
+    v_systematic.push_back(Systematic::Systematic(benchmarkSystematics[i], Systematic::down));
+  }
+
+  std::cout << "\n--- Benchmark configuration: " << nCategories << " categories, " << nProcesses << " processes, "
+            << nBins << " bins, " << nSystematics << " systematics, " << nThreads << " threads\n\n";
+
+  // Generate synthetic inputs, in a separate process not counted in the results
+  gSystem->mkdir((workDir+"/FileLists").c_str(), kTRUE);
+  if(!keepInputs) {
+    const auto start = std::chrono::steady_clock::now();
+    if(!generateInputsSeparately(workDir, fileNames, processNames, v_channel, v_systematic, nBins)) {
+      std::cerr << "Error in benchmarkDatacard! Cannot generate synthetic inputs in: " << workDir << "\n...break\n" << std::endl;
+      exit(1);
+    }
+    std::cout << "Generated inputs in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s\n\n";
+  }
+
+  // Read analysis config from text file
+  const AnalysisConfig analysisConfig;
+
+  // Datacards are written relative to the working directory
+  gSystem->ChangeDirectory(workDir.c_str());
+
+  // The datacard production runs end-to-end, the per-stage numbers (index, read yields, statistical templates, write)
+  // are those of the profiler
+  DatacardProfiler::instance().setEnabled(true);
+
+  const auto start = std::chrono::steady_clock::now();
+
+  DatacardMaker datacard(analysisConfig, fileNames, processNames, v_channel, v_systematic, "FileLists");
+  datacard.setNumberOfThreads(nThreads);
+  datacard.writeDatacards();
+
+  const double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // Do not leave the manifest of resolved inputs as side effect of the benchmark
+  std::remove(datacard.manifestFileName().c_str());
+
+  std::cout << "\n=== Benchmark results\n\n";
+  std::cout << "Wall time:     " << wallTime << " s\n";
+  std::cout << "Peak RSS:      " << peakRss() << " MB\n\n";
+  std::cout << "Per stage (times and counts include nested stages, except for the output writing in write):\n\n";
+  DatacardProfiler::instance().print(std::cout);
+  DatacardProfiler::instance().writeJson("benchmark.json");
+  std::cout << "\nWritten profile: " << workDir << "/benchmark.json\n\n";
+}
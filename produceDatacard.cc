@@ -14,6 +14,7 @@
 #include "EventYields.h"
 #include "plotterHelpers.h"
 #include "DatacardMaker.h"
+#include "DatacardProfiler.h"
 #include "PlotterSystematic.h"
 #include "HistoListReader.h"
 #include "higgsUtils.h"
@@ -127,6 +128,12 @@ int main(int argc, char** argv){
   CLParameter<std::string> opt_filelist("l", "Indicate which tag to use with FileLists_plot directory version (e.g. FileList_plot_<tag>)", false, 1, 1);
   CLParameter<std::string> opt_addStatUncertainty("stat", "Include statistical uncertianties in the datacards, default set to true", false, 1, 1);
   CLParameter<std::string> opt_addSysUncertainty("sys", "Include systematic  uncertianties in the datacards, default set to true", false, 1, 1);
+  CLParameter<std::string> opt_statMode("statMode", "Mode of the MC statistical uncertainties, valid: binByBin, autoMCStats, default set to binByBin", false, 1, 1);
+  CLParameter<std::string> opt_threads("j", "Number of datacards produced in parallel, default set to 1", false, 1, 1);
+  CLParameter<std::string> opt_incremental("incremental", "Write only datacards and histograms whose inputs changed since the previous run, default set to false", false, 1, 1);
+  CLParameter<std::string> opt_profile("profile", "Write time spent and I/O operations per stage of the datacard production to given JSON file", false, 1, 1);
+  CLParameter<std::string> opt_snapshot("snapshot", "Take the input histograms from given snapshot file instead of the input root files", false, 1, 1);
+  CLParameter<std::string> opt_exportSnapshot("exportSnapshot", "Write all input histograms to given snapshot file, for use with -snapshot in later runs", false, 1, 1);
 
   CLParameter<std::string> opt_plot("p", "Name (pattern) of plot; multiple patterns possible; use '+Name' to match name exactly", false, 1, 100);
   CLParameter<std::string> opt_channel("c", "Specify channel(s), valid: emu, ee, mumu, combined. Default: all channels", false, 1, 4,
@@ -222,8 +229,33 @@ int main(int argc, char** argv){
     bool param = (opt_addStatUncertainty.getArguments())[0] == "true" ? true : false;
     datacard.setIncludeStatisticalUncertainties(param);
   }
+  if(opt_statMode.isSet()){
+    datacard.setStatisticalUncertaintyMode((opt_statMode.getArguments())[0]);
+  }
+  if(opt_threads.isSet()){
+    int param = std::atoi((opt_threads.getArguments())[0].c_str());
+    datacard.setNumberOfThreads(param);
+  }
+  if(opt_incremental.isSet()){
+    bool param = (opt_incremental.getArguments())[0] == "true" ? true : false;
+    datacard.setIncremental(param);
+  }
+  if(opt_snapshot.isSet()){
+    datacard.setSnapshotInput((opt_snapshot.getArguments())[0]);
+  }
+  if(opt_exportSnapshot.isSet()){
+    datacard.setSnapshotOutput((opt_exportSnapshot.getArguments())[0]);
+  }
+  if(opt_profile.isSet()){
+    DatacardProfiler::instance().setEnabled(true);
+  }
   datacard.writeDatacards();
 
+  if(opt_profile.isSet()){
+    std::cout << "Writing profile: " << (opt_profile.getArguments())[0] << std::endl;
+    DatacardProfiler::instance().writeJson((opt_profile.getArguments())[0]);
+  }
+
   std::cout << "\n=== Finishing with the datacard production\n\n";
 }
 
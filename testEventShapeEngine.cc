@@ -0,0 +1,322 @@
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include "EventShapeEngine.h"
+
+
+
+
+
+/// Momentum as provided by the analysis objects
+struct TestMomentum{
+  double px, py, pz;
+  double Px()const{return px;}
+  double Py()const{return py;}
+  double Pz()const{return pz;}
+};
+
+/// Event shapes as used in the MVA, all observables in double precision
+typedef EventShapeEngine<double, 16> FullEngine;
+
+/// Reduced build: single precision, only momentum tensor and Fox-Wolfram moments
+typedef EventShapeEngine<float, 16, EventShapeObservable::momentumTensor | EventShapeObservable::foxWolfram> ReducedEngine;
+
+static const double pi = 3.14159265358979323846;
+
+
+
+/// Whether the value agrees with the reference within the tolerance, else print them
+bool check(const char* name, const int event, const double value, const double reference, const double tolerance)
+{
+  if(std::fabs(value - reference) <= tolerance) return true;
+  std::cerr << "Mismatch of " << name << " in event " << event << ": " << value << " vs. reference " << reference << "\n";
+  return false;
+}
+
+
+
+/// Random momenta with integer components, of given number
+std::vector<TestMomentum> randomMomenta(const int numberOfMomenta)
+{
+  std::vector<TestMomentum> momenta;
+  for(int i = 0; i < numberOfMomenta; ++i) momenta.push_back({std::rand()%2000 - 1000., std::rand()%2000 - 1000., std::rand()%4000 - 2000.});
+  return momenta;
+}
+
+
+
+/// Indices of all momenta, in reversed order
+std::vector<int> allIndices(const std::vector<TestMomentum>& momenta)
+{
+  std::vector<int> indices;
+  for(int i = momenta.size() - 1; i >= 0; --i) indices.push_back(i);
+  return indices;
+}
+
+
+
+/// Eigenvalues of the symmetric 3x3 matrix xx, yy, zz, xy, xz, yz by cyclic Jacobi rotations, in descending order
+void jacobiEigenValues(const double* tensor, double* eigenValues)
+{
+  double a[3][3] = {{tensor[0], tensor[3], tensor[4]},
+                    {tensor[3], tensor[1], tensor[5]},
+                    {tensor[4], tensor[5], tensor[2]}};
+
+  for(int sweep = 0; sweep < 50; ++sweep){
+    if(a[0][1] == 0 && a[0][2] == 0 && a[1][2] == 0) break;
+
+    for(int p = 0; p < 2; ++p){
+      for(int q = p+1; q < 3; ++q){
+        if(a[p][q] == 0) continue;
+
+        // Rotation in the (p,q) plane zeroing the element pq
+        const double theta = (a[q][q] - a[p][p])/(2*a[p][q]);
+        const double t = (theta < 0 ? -1. : 1.)/(std::fabs(theta) + std::sqrt(theta*theta + 1));
+        const double c = 1/std::sqrt(t*t + 1);
+        const double s = t*c;
+
+        for(int k = 0; k < 3; ++k){
+          const double akp = a[k][p], akq = a[k][q];
+          a[k][p] = c*akp - s*akq;
+          a[k][q] = s*akp + c*akq;
+        }
+        for(int k = 0; k < 3; ++k){
+          const double apk = a[p][k], aqk = a[q][k];
+          a[p][k] = c*apk - s*aqk;
+          a[q][k] = s*apk + c*aqk;
+        }
+      }
+    }
+  }
+
+  for(int i = 0; i < 3; ++i) eigenValues[i] = a[i][i];
+  std::sort(eigenValues, eigenValues+3, [](const double x, const double y){return x > y;});
+}
+
+
+
+/// Events of known event shapes
+/// Fox-Wolfram moments follow the definition the MVA was trained with, where each momentum enters the sum with itself
+/// three times: H_l = (sum_{i!=j} |p_i||p_j|*P_l(cos(phi_ij)) + 3*sum_i |p_i|^2)/(sum_i |p_i|)^2
+int testAnalyticConfigurations()
+{
+  int failures(0);
+  const double e = 1.e4;
+  const double tolerance = 1.e-6;
+
+  // Back-to-back pair: linear event
+  {
+    const std::vector<TestMomentum> momenta = {{e, 0., 0.}, {-e, 0., 0.}};
+    FullEngine engine;
+    engine.setInputs(momenta, allIndices(momenta));
+    engine.compute();
+
+    bool ok = check("isotropy of back-to-back pair", 0, engine.isotropy(), 1., tolerance);
+    ok = check("circularity of back-to-back pair", 0, engine.circularity(), 0., tolerance) && ok;
+    ok = check("sphericity of back-to-back pair", 0, engine.sphericity(), 0., tolerance) && ok;
+    ok = check("aplanarity of back-to-back pair", 0, engine.aplanarity(), 0., tolerance) && ok;
+    ok = check("C of back-to-back pair", 0, engine.C(), 0., tolerance) && ok;
+    ok = check("D of back-to-back pair", 0, engine.D(), 0., tolerance) && ok;
+    for(int order = 0; order <= 4; ++order) ok = check("H of back-to-back pair", order, engine.H(order), order%2 ? 1. : 2., tolerance) && ok;
+    if(!ok) ++failures;
+  }
+
+  // Orthogonal triplet of equal momenta: spherical event
+  {
+    const std::vector<TestMomentum> momenta = {{e, 0., 0.}, {0., e, 0.}, {0., 0., e}};
+    FullEngine engine;
+    engine.setInputs(momenta, allIndices(momenta));
+    engine.compute();
+
+    bool ok = check("sphericity of orthogonal triplet", 0, engine.sphericity(), 1., tolerance);
+    ok = check("aplanarity of orthogonal triplet", 0, engine.aplanarity(), 0.5, tolerance) && ok;
+    ok = check("C of orthogonal triplet", 0, engine.C(), 1., tolerance) && ok;
+    ok = check("D of orthogonal triplet", 0, engine.D(), 1., tolerance) && ok;
+    ok = check("H0 of orthogonal triplet", 0, engine.H(0), 5./3., tolerance) && ok;
+    ok = check("H1 of orthogonal triplet", 0, engine.H(1), 1., tolerance) && ok;
+    ok = check("H2 of orthogonal triplet", 0, engine.H(2), 2./3., tolerance) && ok;
+    if(!ok) ++failures;
+  }
+
+  // Three equal momenta at 120 degrees in r-phi: planar event, f(phi) between sqrt(3)*e and 2*e
+  {
+    const std::vector<TestMomentum> momenta = {{e, 0., 0.}, {-0.5*e, std::sqrt(0.75)*e, 0.}, {-0.5*e, -std::sqrt(0.75)*e, 0.}};
+    FullEngine engine;
+    engine.setInputs(momenta, allIndices(momenta));
+    engine.compute();
+
+    bool ok = check("isotropy of planar triplet", 0, engine.isotropy(), 1. - std::sqrt(0.75), tolerance);
+    ok = check("circularity of planar triplet", 0, engine.circularity(), pi/(2*std::sqrt(3.)), tolerance) && ok;
+    ok = check("sphericity of planar triplet", 0, engine.sphericity(), 0.75, tolerance) && ok;
+    ok = check("aplanarity of planar triplet", 0, engine.aplanarity(), 0., tolerance) && ok;
+    ok = check("C of planar triplet", 0, engine.C(), 0.75, tolerance) && ok;
+    ok = check("D of planar triplet", 0, engine.D(), 0., tolerance) && ok;
+    ok = check("transverse sphericity of planar triplet", 0, engine.transSphericity(), 1., tolerance) && ok;
+    if(!ok) ++failures;
+  }
+
+  return failures;
+}
+
+
+
+/// Isotropy and circularity against a brute-force scan of the sum of absolute projected transverse momenta in phi
+int testPhiScan()
+{
+  int failures(0);
+  const int numberOfSteps = 100000;
+  const double step = pi/numberOfSteps;
+
+  for(int event = 0; event < 500; ++event){
+    const std::vector<TestMomentum> momenta = randomMomenta(2 + event%9);
+
+    FullEngine engine;
+    engine.setInputs(momenta, allIndices(momenta));
+    engine.compute();
+
+    double sumPt(0.);
+    for(const TestMomentum& momentum : momenta) sumPt += std::sqrt(momentum.px*momentum.px + momentum.py*momentum.py);
+
+    double scanMinimum(sumPt), scanMaximum(0.);
+    for(int i = 0; i < numberOfSteps; ++i){
+      const double cosPhi = std::cos(i*step);
+      const double sinPhi = std::sin(i*step);
+      double sum(0.);
+      for(const TestMomentum& momentum : momenta) sum += std::fabs(cosPhi*momentum.px + sinPhi*momentum.py);
+      scanMinimum = std::min(scanMinimum, sum);
+      scanMaximum = std::max(scanMaximum, sum);
+    }
+
+    // Extrema from the engine, which the scan can only approach to within the slope of at most sumPt times the step
+    const double minimum = 2/pi*engine.circularity()*sumPt;
+    const double maximum = minimum/(1 - engine.isotropy());
+    const double resolution = sumPt*step;
+    const double rounding = 1.e-9*sumPt;
+
+    bool ok = check("minimum of phi scan", event, minimum, scanMinimum, resolution);
+    ok = check("maximum of phi scan", event, maximum, scanMaximum, resolution) && ok;
+    if(minimum > scanMinimum + rounding || maximum < scanMaximum - rounding){
+      std::cerr << "Extrema in event " << event << " not beyond those of the phi scan: " << minimum << ", " << maximum
+                << " vs. scan " << scanMinimum << ", " << scanMaximum << "\n";
+      ok = false;
+    }
+    if(!ok) ++failures;
+  }
+
+  return failures;
+}
+
+
+
+/// Eigenvalues of the momentum tensor against a Jacobi diagonalisation of the tensor built independently
+int testEigenValues()
+{
+  int failures(0);
+
+  for(int event = 0; event < 5000; ++event){
+
+    // Few momenta give (nearly) singular tensors
+    const std::vector<TestMomentum> momenta = randomMomenta(2 + event%8);
+    const double r = event%2 ? 1. : 2.;
+
+    FullEngine engine;
+    engine.setInputs(momenta, allIndices(momenta));
+    engine.compute(r);
+
+    double tensor[6] = {0., 0., 0., 0., 0., 0.};
+    double norm(1.);
+    for(const TestMomentum& momentum : momenta){
+      const double p = std::sqrt(momentum.px*momentum.px + momentum.py*momentum.py + momentum.pz*momentum.pz);
+      const double weight = std::pow(p, r - 2);
+      norm += std::pow(p, r);
+      tensor[0] += weight*momentum.px*momentum.px;
+      tensor[1] += weight*momentum.py*momentum.py;
+      tensor[2] += weight*momentum.pz*momentum.pz;
+      tensor[3] += weight*momentum.px*momentum.py;
+      tensor[4] += weight*momentum.px*momentum.pz;
+      tensor[5] += weight*momentum.py*momentum.pz;
+    }
+    for(int i = 0; i < 6; ++i) tensor[i] /= norm;
+
+    double reference[3];
+    jacobiEigenValues(tensor, reference);
+
+    bool ok(true);
+    for(int i = 0; i < 3; ++i) ok = check("eigenvalue", event, engine.eigenValues()[i], reference[i], 1.e-12) && ok;
+
+    // Momentum tensor is positive semi-definite, also for the singular tensors of few momenta
+    if(engine.eigenValues()[2] < 0.){
+      std::cerr << "Negative eigenvalue in event " << event << "\n";
+      ok = false;
+    }
+    if(!ok) ++failures;
+  }
+
+  return failures;
+}
+
+
+
+/// Reduced single precision engine against the full double precision one
+int testReducedEngine()
+{
+  int failures(0);
+  const double tolerance = 1.e-4;
+
+  for(int event = 0; event < 10000; ++event){
+
+    // Events with 0 up to 20 momenta, i.e. also beyond the storage held in the engines
+    const std::vector<TestMomentum> momenta = randomMomenta(event%21);
+    const std::vector<int> indices = allIndices(momenta);
+
+    FullEngine full;
+    full.setInputs(momenta, indices);
+    full.compute();
+
+    ReducedEngine reduced;
+    reduced.setInputs(momenta, indices);
+    reduced.compute();
+
+    bool ok = check("float sphericity", event, reduced.sphericity(), full.sphericity(), tolerance*(1 + std::fabs(full.sphericity())));
+    ok = check("float aplanarity", event, reduced.aplanarity(), full.aplanarity(), tolerance*(1 + std::fabs(full.aplanarity()))) && ok;
+    ok = check("float C", event, reduced.C(), full.C(), tolerance*(1 + std::fabs(full.C()))) && ok;
+    ok = check("float D", event, reduced.D(), full.D(), tolerance*(1 + std::fabs(full.D()))) && ok;
+    ok = check("float H2", event, reduced.H<2>(), full.H<2>(), tolerance*(1 + std::fabs(full.H<2>()))) && ok;
+    ok = check("float R4", event, reduced.R(4), full.R(4), tolerance*(1 + std::fabs(full.R(4)))) && ok;
+
+    if(reduced.aplanarity() < 0.f || reduced.D() < 0.f){
+      std::cerr << "Negative float aplanarity or D in event " << event << "\n";
+      ok = false;
+    }
+
+    // Orders beyond the computed ones give 0
+    if(full.H(5) != 0. || full.R(5) != 0.){
+      std::cerr << "Fox-Wolfram moment of order not computed is not 0 in event " << event << "\n";
+      ok = false;
+    }
+
+    if(!ok) ++failures;
+  }
+
+  return failures;
+}
+
+
+
+int main(){
+
+  std::srand(4357);
+
+  const int failures = testAnalyticConfigurations() + testPhiScan() + testEigenValues() + testReducedEngine();
+
+  if(failures) {
+    std::cerr << "\nEventShapeEngine test failed for " << failures << " events\n";
+    return 1;
+  }
+
+  std::cout << "EventShapeEngine test passed\n";
+  return 0;
+}